@@ -0,0 +1,87 @@
+#include "Bitboard.h"
+
+namespace Bitboard {
+
+static constexpr bool on_board(int rank, int file) {
+    return rank >= 0 && rank < 8 && file >= 0 && file < 8;
+}
+
+static constexpr uint64_t offsets_mask(int sq, const int (&offsets)[8][2], int n) {
+    uint64_t mask = 0;
+    int rank = sq / 8, file = sq % 8;
+    for (int i = 0; i < n; i++) {
+        int r = rank + offsets[i][0], f = file + offsets[i][1];
+        if (on_board(r, f)) mask |= 1ULL << (r * 8 + f);
+    }
+    return mask;
+}
+
+static constexpr int KNIGHT_OFFSETS[8][2] = {{1,2},{2,1},{2,-1},{1,-2},{-1,-2},{-2,-1},{-2,1},{-1,2}};
+static constexpr int KING_OFFSETS[8][2] = {{1,0},{1,1},{0,1},{-1,1},{-1,0},{-1,-1},{0,-1},{1,-1}};
+static constexpr int WHITE_PAWN_OFFSETS[8][2] = {{1,-1},{1,1}};
+static constexpr int BLACK_PAWN_OFFSETS[8][2] = {{-1,-1},{-1,1}};
+
+// Same order as the Direction enum
+static constexpr int DIRECTION_STEPS[8][2] = {{1,0},{1,1},{0,1},{1,-1},{-1,0},{-1,-1},{0,-1},{-1,1}};
+
+static constexpr std::array<uint64_t, 64> make_table(const int (&offsets)[8][2], int n) {
+    std::array<uint64_t, 64> table = {};
+    for (int sq = 0; sq < 64; sq++) table[sq] = offsets_mask(sq, offsets, n);
+    return table;
+}
+
+static constexpr std::array<std::array<uint64_t, 64>, 8> make_rays() {
+    std::array<std::array<uint64_t, 64>, 8> rays = {};
+    for (int dir = 0; dir < 8; dir++) {
+        for (int sq = 0; sq < 64; sq++) {
+            uint64_t mask = 0;
+            int r = sq / 8 + DIRECTION_STEPS[dir][0], f = sq % 8 + DIRECTION_STEPS[dir][1];
+            for (; on_board(r, f); r += DIRECTION_STEPS[dir][0], f += DIRECTION_STEPS[dir][1]) {
+                mask |= 1ULL << (r * 8 + f);
+            }
+            rays[dir][sq] = mask;
+        }
+    }
+    return rays;
+}
+
+// between/line tables for every pair of squares sharing a rank, file or diagonal
+static constexpr std::array<std::array<uint64_t, 64>, 64> make_pair_table(bool is_line) {
+    std::array<std::array<uint64_t, 64>, 8> rays = make_rays();
+    std::array<std::array<uint64_t, 64>, 64> table = {};
+    for (int a = 0; a < 64; a++) {
+        for (int dir = 0; dir < 8; dir++) {
+            int opposite = (dir + 4) % 8;
+            uint64_t ray = rays[dir][a];
+            while (ray) {
+                int b = __builtin_ctzll(ray);
+                ray &= ray - 1;
+                table[a][b] = is_line ? (rays[dir][a] | rays[opposite][a] | (1ULL << a)) : (rays[dir][a] & rays[opposite][b]);
+            }
+        }
+    }
+    return table;
+}
+
+constexpr std::array<uint64_t, 64> KNIGHT_ATTACKS = make_table(KNIGHT_OFFSETS, 8);
+constexpr std::array<uint64_t, 64> KING_ATTACKS = make_table(KING_OFFSETS, 8);
+constexpr std::array<std::array<uint64_t, 64>, 2> PAWN_ATTACKS = {
+    make_table(WHITE_PAWN_OFFSETS, 2),
+    make_table(BLACK_PAWN_OFFSETS, 2),
+};
+constexpr std::array<std::array<uint64_t, 64>, 8> RAYS = make_rays();
+constexpr std::array<std::array<uint64_t, 64>, 64> BETWEEN = make_pair_table(false);
+constexpr std::array<std::array<uint64_t, 64>, 64> LINE = make_pair_table(true);
+
+std::string str(uint64_t bb) {
+    std::string res = "";
+    for (int rank = 7; rank >= 0; rank--) {
+        for (int file = 0; file < 8; file++) {
+            res += (bb & square_bb(rank * 8 + file)) ? '1' : '.';
+        }
+        res += '\n';
+    }
+    return res;
+}
+
+} // namespace Bitboard
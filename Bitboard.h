@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <string>
+
+/**
+ * Bitboard primitives used by ChessGameState move generation
+ *
+ * Squares are indexed as rank * 8 + file (a1 = 0, h1 = 7, a8 = 56, h8 = 63),
+ * matching ChessGameState::current_position[rank][file].
+ */
+namespace Bitboard {
+
+enum Color {
+    WHITE = 0,
+    BLACK = 1,
+};
+
+static const uint64_t FILE_A = 0x0101010101010101ULL;
+static const uint64_t FILE_H = FILE_A << 7;
+static const uint64_t RANK_1 = 0xFFULL;
+static const uint64_t RANK_8 = RANK_1 << 56;
+
+/**
+ * Ray directions, positive ones (increasing square index) first
+ */
+enum Direction {
+    NORTH = 0,
+    NORTH_EAST = 1,
+    EAST = 2,
+    NORTH_WEST = 3,
+
+    SOUTH = 4,
+    SOUTH_WEST = 5,
+    WEST = 6,
+    SOUTH_EAST = 7,
+};
+
+// Precomputed attack tables (built at compile time in Bitboard.cpp)
+extern const std::array<uint64_t, 64> KNIGHT_ATTACKS;
+extern const std::array<uint64_t, 64> KING_ATTACKS;
+extern const std::array<std::array<uint64_t, 64>, 2> PAWN_ATTACKS;  // [color][square]
+extern const std::array<std::array<uint64_t, 64>, 8> RAYS;          // [direction][square], excluding the square itself
+extern const std::array<std::array<uint64_t, 64>, 64> BETWEEN;      // squares strictly between two aligned squares, else 0
+extern const std::array<std::array<uint64_t, 64>, 64> LINE;         // full board line through two aligned squares, else 0
+
+inline uint64_t square_bb(int sq) {
+    return 1ULL << sq;
+}
+
+inline int lsb(uint64_t bb) {
+    return __builtin_ctzll(bb);
+}
+
+inline int msb(uint64_t bb) {
+    return 63 - __builtin_clzll(bb);
+}
+
+inline int pop_lsb(uint64_t& bb) {
+    int sq = lsb(bb);
+    bb &= bb - 1;
+    return sq;
+}
+
+inline int count(uint64_t bb) {
+    return __builtin_popcountll(bb);
+}
+
+/**
+ * Sliding attacks along a single ray, stopping at (and including) the first blocker
+ */
+inline uint64_t ray_attacks(int sq, uint64_t occupied, Direction dir) {
+    uint64_t attacks = RAYS[dir][sq];
+    uint64_t blockers = attacks & occupied;
+    if (blockers) {
+        int blocker = (dir < SOUTH) ? lsb(blockers) : msb(blockers);
+        attacks ^= RAYS[dir][blocker];
+    }
+    return attacks;
+}
+
+inline uint64_t bishop_attacks(int sq, uint64_t occupied) {
+    return ray_attacks(sq, occupied, NORTH_EAST) | ray_attacks(sq, occupied, NORTH_WEST) |
+           ray_attacks(sq, occupied, SOUTH_EAST) | ray_attacks(sq, occupied, SOUTH_WEST);
+}
+
+inline uint64_t rook_attacks(int sq, uint64_t occupied) {
+    return ray_attacks(sq, occupied, NORTH) | ray_attacks(sq, occupied, SOUTH) |
+           ray_attacks(sq, occupied, EAST) | ray_attacks(sq, occupied, WEST);
+}
+
+inline uint64_t queen_attacks(int sq, uint64_t occupied) {
+    return bishop_attacks(sq, occupied) | rook_attacks(sq, occupied);
+}
+
+/**
+ * Render a bitboard as an 8x8 grid (rank 8 on top), for debugging
+ */
+std::string str(uint64_t bb);
+
+} // namespace Bitboard
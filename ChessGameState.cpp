@@ -1,6 +1,7 @@
 #include "ChessGameState.h"
 #include <iostream>
 #include <stdexcept>
+#include <cstring>
 
 using namespace std;
 
@@ -16,6 +17,7 @@ string ChessSquare::get_san() {
     return res;
 }
 
+ChessMove::ChessMove() : data(0) {}
 ChessMove::ChessMove(string from_sq, string to_sq) {
     if (from_sq.length() != 2 || to_sq.length() != 2) {
         throw invalid_argument("Invalid Input");
@@ -35,325 +37,194 @@ ChessMove::ChessMove(string from_sq, string to_sq) {
         throw invalid_argument("Invalid Input");
     }
 
-    ChessMove::from_san = from_sq;
-    ChessMove::to_san = to_sq;
-
-    ChessMove::from_sq.rank = from_sq[1]-48;
-    ChessMove::from_sq.file = from_sq[0]-97;
-
-    ChessMove::to_sq.rank = to_sq[1]-48;
-    ChessMove::to_sq.file = to_sq[0]-97;
+    *this = ChessMove((from_sq[1]-49)*8 + (from_sq[0]-97), (to_sq[1]-49)*8 + (to_sq[0]-97));
 }
-ChessMove::ChessMove(ChessSquare from_sq, ChessSquare to_sq) {
-    ChessMove::from_san = from_sq.get_san();
-    ChessMove::to_san = to_sq.get_san();
-
-    ChessMove::from_sq = from_sq;
-    ChessMove::to_sq = to_sq;
+ChessMove::ChessMove(ChessSquare from_sq, ChessSquare to_sq) : ChessMove(from_sq.rank*8 + from_sq.file, to_sq.rank*8 + to_sq.file) {}
+ChessMove::ChessMove(ChessSquare from_sq, ChessSquare to_sq, PromotionPieceType promotion_type) :
+    ChessMove(from_sq.rank*8 + from_sq.file, to_sq.rank*8 + to_sq.file, MoveFlags::NORMAL_MOVE, promotion_type) {}
+ChessMove::ChessMove(int from, int to, MoveFlags flags, PromotionPieceType promotion_type) {
+    ChessMove::data = (uint16_t)(from | (to << 6) | ((promotion_type - PromotionPieceType::PROMOTED_KNIGHT) << 12) | (flags << 14));
 }
-ChessMove::ChessMove(ChessSquare from_sq, ChessSquare to_sq, PromotionPieceType promotion_type) {
-    ChessMove::from_san = from_sq.get_san();
-    ChessMove::to_san = to_sq.get_san();
-
-    ChessMove::from_sq = from_sq;
-    ChessMove::to_sq = to_sq;
 
-    ChessMove::promotion_type = promotion_type;
+int ChessMove::from() const {
+    return ChessMove::data & 0x3F;
+}
+int ChessMove::to() const {
+    return (ChessMove::data >> 6) & 0x3F;
+}
+ChessSquare ChessMove::from_square() const {
+    return {ChessMove::from() / 8, ChessMove::from() % 8};
+}
+ChessSquare ChessMove::to_square() const {
+    return {ChessMove::to() / 8, ChessMove::to() % 8};
+}
+PromotionPieceType ChessMove::promotion() const {
+    return (PromotionPieceType)(((ChessMove::data >> 12) & 0x3) + PromotionPieceType::PROMOTED_KNIGHT);
+}
+MoveFlags ChessMove::flags() const {
+    return (MoveFlags)(ChessMove::data >> 14);
+}
+bool ChessMove::is_null() const {
+    return ChessMove::from() == ChessMove::to();
 }
 
 string ChessMove::str() const {
-    return "(" + ChessMove::from_san + "," + ChessMove::to_san + ")";
+    return "(" + ChessMove::from_square().get_san() + "," + ChessMove::to_square().get_san() + ")";
 }
 
 string ChessMove::repr() const {
-    return "<" + ChessMove::from_san + " -> " + ChessMove::to_san + ">";
+    return "<" + ChessMove::from_square().get_san() + " -> " + ChessMove::to_square().get_san() + ">";
 }
 
 bool ChessMove::operator<(const ChessMove& other) const {
-    if (ChessMove::from_sq.rank != other.from_sq.rank) return ChessMove::from_sq.rank < other.from_sq.rank;
-    if (ChessMove::from_sq.file != other.from_sq.file) return ChessMove::from_sq.file < other.from_sq.file;
-    if (ChessMove::to_sq.rank != other.to_sq.rank) return ChessMove::to_sq.rank < other.to_sq.rank;
-    return ChessMove::to_sq.file < other.to_sq.file;
+    if (ChessMove::from() != other.from()) return ChessMove::from() < other.from();
+    if (ChessMove::to() != other.to()) return ChessMove::to() < other.to();
+    return ChessMove::promotion() < other.promotion();
 }
 
 bool ChessMove::operator==(const ChessMove& other) const {
-    return ChessMove::from_sq == other.from_sq &&
-        ChessMove::to_sq == other.to_sq;
+    return (ChessMove::data & 0x3FFF) == (other.data & 0x3FFF);
 }
 
 // --------------------------------------------------
 
+// castling rights that survive a move touching each square (king or rook leaving, rook captured)
+static const uint16_t CASTLING_RIGHTS_MASK[64] = {
+    (uint16_t)~GameFlags::WHITE_QUEEN_CASTLE, 0xFFFF, 0xFFFF, 0xFFFF,
+    (uint16_t)~(GameFlags::WHITE_KING_CASTLE | GameFlags::WHITE_QUEEN_CASTLE), 0xFFFF, 0xFFFF, (uint16_t)~GameFlags::WHITE_KING_CASTLE,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+    0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+    (uint16_t)~GameFlags::BLACK_QUEEN_CASTLE, 0xFFFF, 0xFFFF, 0xFFFF,
+    (uint16_t)~(GameFlags::BLACK_KING_CASTLE | GameFlags::BLACK_QUEEN_CASTLE), 0xFFFF, 0xFFFF, (uint16_t)~GameFlags::BLACK_KING_CASTLE,
+};
+
+// Zobrist keys, generated at compile time with splitmix64 so hashes are stable across runs
+namespace Zobrist {
+
+static constexpr uint64_t splitmix64(uint64_t& seed) {
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+struct Keys {
+    uint64_t pieces[12][64] = {};
+    uint64_t castling[16] = {};
+    uint64_t enpassant[8] = {};
+    uint64_t black_turn = 0;
+};
+
+static constexpr Keys make_keys() {
+    Keys keys;
+    uint64_t seed = 0x43484553534C454EULL;
+    for (int piece = 0; piece < 12; piece++)
+        for (int sq = 0; sq < 64; sq++) keys.pieces[piece][sq] = splitmix64(seed);
+    for (int i = 0; i < 16; i++) keys.castling[i] = splitmix64(seed);
+    for (int i = 0; i < 8; i++) keys.enpassant[i] = splitmix64(seed);
+    keys.black_turn = splitmix64(seed);
+    return keys;
+}
+
+static constexpr Keys KEYS = make_keys();
+
+} // namespace Zobrist
+
+static const uint16_t POSITION_FLAGS = GameFlags::WHITE_TURN |
+    GameFlags::WHITE_KING_CASTLE | GameFlags::WHITE_QUEEN_CASTLE |
+    GameFlags::BLACK_KING_CASTLE | GameFlags::BLACK_QUEEN_CASTLE |
+    GameFlags::EN_PASSANT;
+
+static inline int square_index(const ChessSquare& sq) {
+    return sq.rank * 8 + sq.file;
+}
+
 ChessGameState::ChessGameState(string fen) : parent(nullptr) {
     ChessGameState::parse_fen(fen);
     ChessGameState::flags |= GameFlags::IS_LEGAL;
-    ChessGameState::flags &= ~GameFlags::CHILDREN_COMPUTED;
+    ChessGameState::flags &= ~(GameFlags::CHILDREN_COMPUTED | GameFlags::MOVES_COMPUTED);
 }
-ChessGameState::ChessGameState(const ChessGameState& other, ChessMove move) : parent(&other) {
+ChessGameState::ChessGameState(const ChessGameState& other, ChessMove move) : ChessGameState(other, move, true) {}
+ChessGameState::ChessGameState(const ChessGameState& other, ChessMove move, bool validate) : parent(&other) {
     ChessGameState::fen = "";
     ChessGameState::flags = other.flags;
     ChessGameState::piece_counts = other.piece_counts;
+    ChessGameState::enpassant_sq = other.enpassant_sq;
 
-    for (int rank = 0; rank < 8; rank++)
-    {
-        for (int file = 0; file < 8; file++)
-        {
-            ChessGameState::current_position[rank][file] = other.current_position[rank][file];
-        }
-    }
+    memcpy(ChessGameState::current_position, other.current_position, sizeof(ChessGameState::current_position));
+    memcpy(ChessGameState::piece_bb, other.piece_bb, sizeof(ChessGameState::piece_bb));
+    memcpy(ChessGameState::color_bb, other.color_bb, sizeof(ChessGameState::color_bb));
+    ChessGameState::occupied_bb = other.occupied_bb;
+    ChessGameState::hash = other.hash ^ other.flags_hash();
 
     // apply move
 
-    uint8_t from_piece = ChessGameState::current_position[move.from_sq.rank][move.from_sq.file];
-    uint8_t to_piece = ChessGameState::current_position[move.to_sq.rank][move.to_sq.file];
+    int from = move.from();
+    int to = move.to();
+
+    uint8_t from_piece = ChessGameState::current_position[from / 8][from % 8];
+    uint8_t to_piece = ChessGameState::current_position[to / 8][to % 8];
 
     if (from_piece == 12) throw invalid_argument("Invalid Move");
 
     PieceTypes from_piece_type = (PieceTypes)(from_piece%6);
-    // PieceTypes to_piece_type = (PieceTypes)(to_piece%6);
     bool is_white_turn = ChessGameState::flags & GameFlags::WHITE_TURN;
 
-    if (from_piece_type == (uint8_t)PieceTypes::PAWN && (move.to_sq.rank == 0 || move.to_sq.rank == 7)) {
-        // Piece Counts
-        uint8_t promotion_piece = move.promotion_type + (is_white_turn ? 0 : 6);
-        ChessGameState::piece_counts.empty ++;
-        switch (to_piece)
-        {
-        case 0:
-            ChessGameState::piece_counts.white_pawn--;
-            break;
-        case 1:
-            ChessGameState::piece_counts.white_knight--;
-            break;
-        case 2:
-            ChessGameState::piece_counts.white_bishop--;
-            break;
-        case 3:
-            ChessGameState::piece_counts.white_rook--;
-            break;
-        case 4:
-            ChessGameState::piece_counts.white_queen--;
-            break;
-        case 5:
-            ChessGameState::piece_counts.white_king--;
-            break;
-
-        case 6:
-            ChessGameState::piece_counts.black_pawn--;
-            break;
-        case 7:
-            ChessGameState::piece_counts.black_knight--;
-            break;
-        case 8:
-            ChessGameState::piece_counts.black_bishop--;
-            break;
-        case 9:
-            ChessGameState::piece_counts.black_rook--;
-            break;
-        case 10:
-            ChessGameState::piece_counts.black_queen--;
-            break;
-        case 11:
-            ChessGameState::piece_counts.black_king--;
-            break;
-        
-        case 12:
-            ChessGameState::piece_counts.empty--;
-            break;
-        
-        default:
-            break;
-        }
-        if (is_white_turn) ChessGameState::piece_counts.white_pawn--;
-        else ChessGameState::piece_counts.black_pawn--;
-        switch (promotion_piece)
-        {
-        case 0:
-            ChessGameState::piece_counts.white_pawn++;
-            break;
-        case 1:
-            ChessGameState::piece_counts.white_knight++;
-            break;
-        case 2:
-            ChessGameState::piece_counts.white_bishop++;
-            break;
-        case 3:
-            ChessGameState::piece_counts.white_rook++;
-            break;
-        case 4:
-            ChessGameState::piece_counts.white_queen++;
-            break;
-        case 5:
-            ChessGameState::piece_counts.white_king++;
-            break;
-
-        case 6:
-            ChessGameState::piece_counts.black_pawn++;
-            break;
-        case 7:
-            ChessGameState::piece_counts.black_knight++;
-            break;
-        case 8:
-            ChessGameState::piece_counts.black_bishop++;
-            break;
-        case 9:
-            ChessGameState::piece_counts.black_rook++;
-            break;
-        case 10:
-            ChessGameState::piece_counts.black_queen++;
-            break;
-        case 11:
-            ChessGameState::piece_counts.black_king++;
-            break;
-        
-        case 12:
-            ChessGameState::piece_counts.empty++;
-            break;
-        
-        default:
-            break;
-        }
-
-        // Move Piece
-        ChessGameState::current_position[move.from_sq.rank][move.from_sq.file] = 12;
-        ChessGameState::current_position[move.to_sq.rank][move.to_sq.file] = promotion_piece;
-
-        // Castling Rights
-        // No Changes
+    ChessGameState::flags &= ~GameFlags::EN_PASSANT;
 
+    if (from_piece_type == PieceTypes::PAWN && (to / 8 == 0 || to / 8 == 7)) {
+        // Promotion
+        if (to_piece != 12) ChessGameState::remove_piece(to);
+        ChessGameState::remove_piece(from);
+        ChessGameState::put_piece(to, move.promotion() + (is_white_turn ? 0 : 6));
+    } else if (from_piece_type == PieceTypes::PAWN && (other.flags&GameFlags::EN_PASSANT) && to == square_index(other.enpassant_sq)) {
         // Enpassant
-        ChessGameState::flags &= ~GameFlags::EN_PASSANT;
-    } else if (from_piece_type == PieceTypes::PAWN && (other.flags&GameFlags::EN_PASSANT) && move.to_sq == other.enpassant_sq) {
-        // Enpassant
-
-        // Piece Counts
-        if (is_white_turn) ChessGameState::piece_counts.black_pawn--;
-        else ChessGameState::piece_counts.white_pawn--;
-        ChessGameState::piece_counts.empty++;
-
-        // Move Pieces
-        ChessGameState::current_position[move.from_sq.rank][move.from_sq.file] = 12;
-        ChessGameState::current_position[move.to_sq.rank][move.to_sq.file] = from_piece;
-        ChessGameState::current_position[move.to_sq.rank+(is_white_turn ? -1 : 1)][move.to_sq.file] = 12;
-
-        // Castling Rights
-        // No Changes
-
-        // Enpassant
-        ChessGameState::flags &= ~GameFlags::EN_PASSANT;
-    } else if (from_piece_type == PieceTypes::KING && (move.to_sq.file == move.from_sq.file+2 || move.to_sq.file == move.from_sq.file-2)) {
+        ChessGameState::remove_piece(from);
+        ChessGameState::put_piece(to, from_piece);
+        ChessGameState::remove_piece(to + (is_white_turn ? -8 : 8));
+    } else if (from_piece_type == PieceTypes::KING && (to == from+2 || to == from-2)) {
         // Castling
-
-        // Piece Counts
-        // No Changes
-
-        // Move Pieces
-        int direction = move.to_sq.file - move.from_sq.file;
-        ChessGameState::current_position[move.from_sq.rank][move.from_sq.file] = 12;
-        ChessGameState::current_position[move.to_sq.rank][move.to_sq.file] = from_piece;
-        ChessGameState::current_position[move.from_sq.rank][move.from_sq.file+(direction/2)] = (is_white_turn ? 3 : 9);
-        ChessGameState::current_position[move.from_sq.rank][(direction > 0) ? 7 : 0] = 12;
-
-        // Castling Rights
-        if (is_white_turn) {
-            ChessGameState:: flags &= ~GameFlags::WHITE_KING_CASTLE;
-            ChessGameState:: flags &= ~GameFlags::WHITE_QUEEN_CASTLE;
-        } else {
-            ChessGameState:: flags &= ~GameFlags::BLACK_KING_CASTLE;
-            ChessGameState:: flags &= ~GameFlags::BLACK_QUEEN_CASTLE;
-        }
-
-        // Enpassant
-        ChessGameState::flags &= ~GameFlags::EN_PASSANT;
+        int direction = to - from;
+        ChessGameState::remove_piece(from);
+        ChessGameState::put_piece(to, from_piece);
+        ChessGameState::remove_piece((from & ~7) + ((direction > 0) ? 7 : 0));
+        ChessGameState::put_piece(from + (direction/2), (is_white_turn ? 3 : 9));
     } else {
         // General Case
+        if (to_piece != 12) ChessGameState::remove_piece(to);
+        ChessGameState::remove_piece(from);
+        ChessGameState::put_piece(to, from_piece);
 
-        // Piece Counts
-        ChessGameState::piece_counts.empty++;
-        switch (to_piece)
-        {
-        case 0:
-            ChessGameState::piece_counts.white_pawn--;
-            break;
-        case 1:
-            ChessGameState::piece_counts.white_knight--;
-            break;
-        case 2:
-            ChessGameState::piece_counts.white_bishop--;
-            break;
-        case 3:
-            ChessGameState::piece_counts.white_rook--;
-            break;
-        case 4:
-            ChessGameState::piece_counts.white_queen--;
-            break;
-        case 5:
-            ChessGameState::piece_counts.white_king--;
-            break;
-
-        case 6:
-            ChessGameState::piece_counts.black_pawn--;
-            break;
-        case 7:
-            ChessGameState::piece_counts.black_knight--;
-            break;
-        case 8:
-            ChessGameState::piece_counts.black_bishop--;
-            break;
-        case 9:
-            ChessGameState::piece_counts.black_rook--;
-            break;
-        case 10:
-            ChessGameState::piece_counts.black_queen--;
-            break;
-        case 11:
-            ChessGameState::piece_counts.black_king--;
-            break;
-        
-        case 12:
-            ChessGameState::piece_counts.empty--;
-            break;
-        
-        default:
-            break;
-        }
-        
-        // Move Piece
-        ChessGameState::current_position[move.from_sq.rank][move.from_sq.file] = 12;
-        ChessGameState::current_position[move.to_sq.rank][move.to_sq.file] = from_piece;
-        
-        // Castling
-        if (from_piece_type == PieceTypes::KING) {
-            if (is_white_turn) {
-                ChessGameState::flags &= ~GameFlags::WHITE_KING_CASTLE;
-                ChessGameState::flags &= ~GameFlags::WHITE_QUEEN_CASTLE;
-            } else {
-                ChessGameState::flags &= ~GameFlags::BLACK_KING_CASTLE;
-                ChessGameState::flags &= ~GameFlags::BLACK_QUEEN_CASTLE;
-            }
-        }
-        if (from_piece_type == PieceTypes::ROOK) {
-            if ((move.from_sq.rank == 0 || move.from_sq.rank == 7) && (move.from_sq.file == 0)) {
-                if (is_white_turn) ChessGameState::flags &= ~GameFlags::WHITE_QUEEN_CASTLE;
-                else ChessGameState::flags &= ~GameFlags::BLACK_QUEEN_CASTLE;
-            } else if ((move.from_sq.rank == 0 || move.from_sq.rank == 7) && (move.from_sq.file == 7)) {
-                if (is_white_turn) ChessGameState::flags &= ~GameFlags::WHITE_KING_CASTLE;
-                else ChessGameState::flags &= ~GameFlags::BLACK_KING_CASTLE;
-            }
-        }
-        // Enpassant
-        ChessGameState::flags &= ~GameFlags::EN_PASSANT;
-        if (from_piece_type == PieceTypes::PAWN && (move.from_sq.rank == 1 || move.from_sq.rank == 6) && (move.to_sq.rank == 3 || move.to_sq.rank == 4)) {
+        // en passant square only recorded when an enemy pawn can actually take it, so transpositions hash equal
+        int enpassant = (from + to) / 2;
+        if (
+            from_piece_type == PieceTypes::PAWN && (to - from == 16 || from - to == 16) &&
+            (Bitboard::PAWN_ATTACKS[is_white_turn ? Bitboard::WHITE : Bitboard::BLACK][enpassant] & ChessGameState::piece_bb[is_white_turn ? 6 : 0])
+        ) {
             ChessGameState::flags |= GameFlags::EN_PASSANT;
-            ChessGameState::enpassant_sq = move.to_sq;
-            ChessGameState::enpassant_sq.rank += (is_white_turn ? -1 : 1);
+            ChessGameState::enpassant_sq = {enpassant / 8, enpassant % 8};
         }
     }
 
+    // Castling Rights
+    ChessGameState::flags &= CASTLING_RIGHTS_MASK[from] & CASTLING_RIGHTS_MASK[to];
+
     // Turn
     ChessGameState::flags ^= GameFlags::WHITE_TURN;
-    if (!ChessGameState::is_valid()) throw invalid_argument("Invalid Move");
+    ChessGameState::hash ^= ChessGameState::flags_hash();
+    if (validate) {
+        if (!ChessGameState::is_valid()) throw invalid_argument("Invalid Move");
+    } else {
+        bool is_white = ChessGameState::flags & GameFlags::WHITE_TURN;
+        ChessGameState::flags &= ~GameFlags::IS_CHECK;
+        if (ChessGameState::is_attacked(Bitboard::lsb(ChessGameState::piece_bb[is_white ? 5 : 11]), !is_white)) ChessGameState::flags |= GameFlags::IS_CHECK;
+    }
     ChessGameState::flags |= GameFlags::IS_LEGAL;
-    ChessGameState::flags &= ~GameFlags::CHILDREN_COMPUTED;
+    ChessGameState::flags &= ~(GameFlags::CHILDREN_COMPUTED | GameFlags::MOVES_COMPUTED);
 }
 ChessGameState::~ChessGameState() {
 }
@@ -362,6 +233,10 @@ void ChessGameState::eval_next() {
     if (!(ChessGameState::flags & GameFlags::CHILDREN_COMPUTED)) ChessGameState::compute_children();
 }
 
+void ChessGameState::eval_moves() {
+    if (!(ChessGameState::flags & GameFlags::MOVES_COMPUTED)) ChessGameState::compute_moves();
+}
+
 // double ChessGameState::eval_prob() {
 //     return 0;
 // }
@@ -377,8 +252,18 @@ const ChessGameState* ChessGameState::get_parent() {
     return ChessGameState::parent;
 }
 
+uint64_t ChessGameState::get_hash() const {
+    return ChessGameState::hash;
+}
+
+bool ChessGameState::is_same_position(const ChessGameState& other) const {
+    if ((ChessGameState::flags & POSITION_FLAGS) != (other.flags & POSITION_FLAGS)) return false;
+    if ((ChessGameState::flags & GameFlags::EN_PASSANT) && !(ChessGameState::enpassant_sq == other.enpassant_sq)) return false;
+    return memcmp(ChessGameState::piece_bb, other.piece_bb, sizeof(ChessGameState::piece_bb)) == 0;
+}
+
 vector<ChessMove> ChessGameState::get_legal_moves() {
-    if (!(ChessGameState::flags & GameFlags::CHILDREN_COMPUTED)) ChessGameState::compute_children();
+    if (!(ChessGameState::flags & GameFlags::MOVES_COMPUTED)) ChessGameState::compute_moves();
     vector<ChessMove> res;
     for (const auto& [mv, state] : ChessGameState::children) {
         res.push_back(mv);
@@ -394,14 +279,79 @@ vector<ChessGameState*> ChessGameState::get_children() {
     return res;
 }
 
+void ChessGameState::generate_children(vector<pair<ChessMove, ChessGameState>>& children) const {
+    static thread_local vector<ChessMove> moves;
+    moves.clear();
+    ChessGameState::generate_legal_moves(moves);
+
+    children.clear();
+    children.reserve(moves.size());
+    for (const ChessMove& move : moves) {
+        children.emplace_back(move, ChessGameState(*this, move, false));
+    }
+}
+
+void ChessGameState::set_children(const vector<pair<ChessMove, ChessGameState>>& children) {
+    ChessGameState::children.clear();
+    ChessGameState::children.reserve(children.size());
+    for (const auto& [move, position] : children) {
+        ChessGameState::add_child(GameStateFactory::intern(position), move);
+    }
+
+    ChessGameState::flags |= GameFlags::CHILDREN_COMPUTED | GameFlags::MOVES_COMPUTED;
+}
+
+bool ChessGameState::is_expanded() const {
+    return ChessGameState::flags & GameFlags::CHILDREN_COMPUTED;
+}
+
+ChessGameState* ChessGameState::get_child(size_t index) {
+    if (!(ChessGameState::flags & GameFlags::MOVES_COMPUTED)) ChessGameState::compute_moves();
+
+    auto& [move, state] = ChessGameState::children.at(index);
+    if (state == nullptr) state = GameStateFactory::create_child(this, move);
+    return state;
+}
+
 ChessGameState* ChessGameState::move(ChessMove move) {
-    if (!(ChessGameState::flags & GameFlags::CHILDREN_COMPUTED)) ChessGameState::compute_children();
+    MoveResult result = ChessGameState::try_make_move(move);
+    if (result.status != MoveStatus::LEGAL) throw invalid_argument("Move Invalid");
 
-    auto it = ChessGameState::children.find(move);
-    if (it == ChessGameState::children.end()) throw invalid_argument("Move Invalid");
+    return result.state;
+}
 
-    ChessGameState* next_pos = it->second;
-    return next_pos;
+MoveResult ChessGameState::try_make_move(ChessMove move) {
+    if (!(ChessGameState::flags & GameFlags::MOVES_COMPUTED)) ChessGameState::compute_moves();
+
+    for (size_t i = 0; i < ChessGameState::children.size(); i++) {
+        if (ChessGameState::children[i].first == move) return {MoveStatus::LEGAL, ChessGameState::get_child(i)};
+    }
+
+    uint8_t piece = ChessGameState::current_position[move.from() / 8][move.from() % 8];
+    bool is_white_turn = ChessGameState::flags & GameFlags::WHITE_TURN;
+
+    if (piece == 12) return {MoveStatus::NO_PIECE};
+    if ((piece < 6) != is_white_turn) return {MoveStatus::WRONG_TURN};
+    return {MoveStatus::ILLEGAL};
+}
+
+uint64_t ChessGameState::perft(int depth) const {
+    if (depth <= 0) return 1;
+
+    // one move list per depth, reused across calls
+    static thread_local vector<vector<ChessMove>> move_lists;
+    if ((int)move_lists.size() < depth) move_lists.resize(depth);
+    vector<ChessMove>& moves = move_lists[depth - 1];
+
+    moves.clear();
+    ChessGameState::generate_legal_moves(moves);
+    if (depth == 1) return moves.size();
+
+    uint64_t nodes = 0;
+    for (const ChessMove& move : moves) {
+        nodes += ChessGameState(*this, move, false).perft(depth - 1);
+    }
+    return nodes;
 }
 
 string ChessGameState::str() {
@@ -516,9 +466,22 @@ void ChessGameState::parse_fen(string fen) {
     bool is_castle_set = false;
     bool is_enpassant_set = false;
 
+    for (int sq = 0; sq < 64; sq++) ChessGameState::current_position[sq / 8][sq % 8] = 12;
+    ChessGameState::piece_counts.empty = 64;
+
+    static const string pieces = "PNBRQKpnbrqk";
+
     for (const char& c : fen)
     {
         if (is_flags == 0) { // board squares
+            size_t piece = pieces.find(c);
+            if (piece != string::npos) {
+                if (rank < 0 || file >= 8) throw invalid_argument("FEN Invalid");
+                ChessGameState::put_piece(rank*8 + file, (uint8_t)piece);
+                file++;
+                continue;
+            }
+
             switch (c)
             {
             case '/':
@@ -526,78 +489,6 @@ void ChessGameState::parse_fen(string fen) {
                 file = 0;
                 break;
 
-            case 'P':
-                ChessGameState::current_position[rank][file] = 0;
-                ChessGameState::piece_counts.white_pawn++;
-                file++;
-                break;
-                
-            case 'N':
-                ChessGameState::current_position[rank][file] = 1;
-                ChessGameState::piece_counts.white_knight++;
-                file++;
-                break;
-                
-            case 'B':
-                ChessGameState::current_position[rank][file] = 2;
-                ChessGameState::piece_counts.white_bishop++;
-                file++;
-                break;
-
-            case 'R':
-                ChessGameState::current_position[rank][file] = 3;
-                ChessGameState::piece_counts.white_rook++;
-                file++;
-                break;
-
-            case 'Q':
-                ChessGameState::current_position[rank][file] = 4;
-                ChessGameState::piece_counts.white_queen++;
-                file++;
-                break;
-            
-            case 'K':
-                ChessGameState::current_position[rank][file] = 5;
-                ChessGameState::piece_counts.white_king++;
-                file++;
-                break;
-
-            case 'p':
-                ChessGameState::current_position[rank][file] = 6;
-                ChessGameState::piece_counts.black_pawn++;
-                file++;
-                break;
-            
-            case 'n':
-                ChessGameState::current_position[rank][file] = 7;
-                ChessGameState::piece_counts.black_knight++;
-                file++;
-                break;
-
-            case 'b':
-                ChessGameState::current_position[rank][file] = 8;
-                ChessGameState::piece_counts.black_bishop++;
-                file++;
-                break;
-
-            case 'r':
-                ChessGameState::current_position[rank][file] = 9;
-                ChessGameState::piece_counts.black_rook++;
-                file++;
-                break;
-
-            case 'q':
-                ChessGameState::current_position[rank][file] = 10;
-                ChessGameState::piece_counts.black_queen++;
-                file++;
-                break;
-            
-            case 'k':
-                ChessGameState::current_position[rank][file] = 11;
-                ChessGameState::piece_counts.black_king++;
-                file++;
-                break;
-
             case ' ':
                 if (!(rank == 0 && file == 8)) throw invalid_argument("FEN Invalid");
                 is_flags++;
@@ -608,12 +499,6 @@ void ChessGameState::parse_fen(string fen) {
                 empty_count = c - 48;
                 if (file + empty_count > 8) throw invalid_argument("FEN Invalid");
 
-                for (int i = file; i < file+empty_count; i++)
-                {
-                    ChessGameState::current_position[rank][i] = 12;
-                    ChessGameState::piece_counts.empty++;
-                }
-
                 file += empty_count;
                 
                 break;
@@ -695,7 +580,7 @@ void ChessGameState::parse_fen(string fen) {
                     is_enpassant_set = true;
                 }
                 else if (c >= 49 && c<= 56) {
-                    ChessGameState::enpassant_sq.rank = c - 48;
+                    ChessGameState::enpassant_sq.rank = c - 49;
                     ChessGameState::flags |= GameFlags::EN_PASSANT;
                     is_enpassant_set = true;
                 }
@@ -707,6 +592,16 @@ void ChessGameState::parse_fen(string fen) {
         }
     }
 
+    if (ChessGameState::flags & GameFlags::EN_PASSANT) {
+        // same convention as moves: drop an en passant square no pawn can capture on
+        bool is_white_turn = ChessGameState::flags & GameFlags::WHITE_TURN;
+        int enpassant = square_index(ChessGameState::enpassant_sq);
+        if (!(Bitboard::PAWN_ATTACKS[is_white_turn ? Bitboard::BLACK : Bitboard::WHITE][enpassant] & ChessGameState::piece_bb[is_white_turn ? 0 : 6]))
+            ChessGameState::flags &= ~GameFlags::EN_PASSANT;
+    }
+
+    ChessGameState::hash ^= ChessGameState::flags_hash();
+
     // TODO: check other flags (stalemate, gameover)
     if (!ChessGameState::is_valid()) throw invalid_argument("FEN Invalid");
 }
@@ -714,32 +609,11 @@ void ChessGameState::parse_fen(string fen) {
 bool ChessGameState::is_valid() {
     if (ChessGameState::piece_counts.white_king != 1 || ChessGameState::piece_counts.black_king != 1) return false;
 
-    bool is_white_checked = false;
-    bool is_black_checked = false;
+    int white_king_sq = Bitboard::lsb(ChessGameState::piece_bb[5]);
+    int black_king_sq = Bitboard::lsb(ChessGameState::piece_bb[11]);
 
-    ChessSquare white_king_sq;
-    ChessSquare black_king_sq;
-    bool white_king_found = false, black_king_found = false;
-    for (int rank = 0; rank < 8; rank++)
-    {
-        for (int file = 0; file < 8; file++)
-        {
-            if (ChessGameState::current_position[rank][file] == 5) {
-                white_king_found = true;
-                white_king_sq.rank = rank;
-                white_king_sq.file = file;
-            } else if (ChessGameState::current_position[rank][file] == 11) {
-                black_king_found = true;
-                black_king_sq.rank = rank;
-                black_king_sq.file = file;
-            }
-            if (white_king_found && black_king_found) break;
-        }
-        if (white_king_found && black_king_found) break;
-    }
-
-    if (ChessGameState::is_attacked(white_king_sq, true)) is_white_checked = true;
-    if (ChessGameState::is_attacked(black_king_sq, false)) is_black_checked = true;
+    bool is_white_checked = ChessGameState::is_attacked(white_king_sq, false);
+    bool is_black_checked = ChessGameState::is_attacked(black_king_sq, true);
 
     if (is_white_checked && is_black_checked) return false;
 
@@ -748,642 +622,303 @@ bool ChessGameState::is_valid() {
     if (is_white_checked && !is_white_turn) return false;
     if (is_black_checked && is_white_turn) return false;
 
+    ChessGameState::flags &= ~GameFlags::IS_CHECK;
     if (is_white_checked || is_black_checked) ChessGameState::flags |= GameFlags::IS_CHECK;
 
     return true;
 }
 
 void ChessGameState::add_child(ChessGameState* new_pos, ChessMove move) {
-    ChessGameState::children[move] = new_pos;
+    ChessGameState::children.emplace_back(move, new_pos);
 }
 
-bool is_square(ChessSquare sq) {
-    return sq.rank >= 0 && sq.rank < 8 && sq.file >= 0 && sq.file < 8;
+uint8_t& ChessGameState::piece_count(uint8_t piece) {
+    switch (piece)
+    {
+    case 0: return ChessGameState::piece_counts.white_pawn;
+    case 1: return ChessGameState::piece_counts.white_knight;
+    case 2: return ChessGameState::piece_counts.white_bishop;
+    case 3: return ChessGameState::piece_counts.white_rook;
+    case 4: return ChessGameState::piece_counts.white_queen;
+    case 5: return ChessGameState::piece_counts.white_king;
+
+    case 6: return ChessGameState::piece_counts.black_pawn;
+    case 7: return ChessGameState::piece_counts.black_knight;
+    case 8: return ChessGameState::piece_counts.black_bishop;
+    case 9: return ChessGameState::piece_counts.black_rook;
+    case 10: return ChessGameState::piece_counts.black_queen;
+    case 11: return ChessGameState::piece_counts.black_king;
+
+    default: return ChessGameState::piece_counts.empty;
+    }
 }
 
-bool ChessGameState::attacking_pawn(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece_type) {
-    uint8_t attacked_piece = (uint8_t)attacked_piece_type + (is_white ? 6 : 0);
-    int rank_diff = is_white ? 1 : -1;
-    if (
-        is_square({piece_square.rank+rank_diff, piece_square.file+1}) &&
-        ChessGameState::current_position[piece_square.rank+rank_diff][piece_square.file+1] == attacked_piece
-    ) return true;
+// side, castling and en passant part of the zobrist key
+uint64_t ChessGameState::flags_hash() const {
+    uint64_t res = Zobrist::KEYS.castling[(ChessGameState::flags >> 1) & 0xF];
+    if (!(ChessGameState::flags & GameFlags::WHITE_TURN)) res ^= Zobrist::KEYS.black_turn;
+    if (ChessGameState::flags & GameFlags::EN_PASSANT) res ^= Zobrist::KEYS.enpassant[ChessGameState::enpassant_sq.file];
+    return res;
+}
 
-    if (
-        is_square({piece_square.rank+rank_diff, piece_square.file-1}) &&
-        ChessGameState::current_position[piece_square.rank+rank_diff][piece_square.file-1] == attacked_piece
-    ) return true;
+void ChessGameState::put_piece(int sq, uint8_t piece) {
+    uint64_t bb = Bitboard::square_bb(sq);
+    ChessGameState::current_position[sq / 8][sq % 8] = piece;
+    ChessGameState::piece_bb[piece] |= bb;
+    ChessGameState::color_bb[piece < 6 ? Bitboard::WHITE : Bitboard::BLACK] |= bb;
+    ChessGameState::occupied_bb |= bb;
+    ChessGameState::hash ^= Zobrist::KEYS.pieces[piece][sq];
 
-    return false;
+    ChessGameState::piece_count(piece)++;
+    ChessGameState::piece_counts.empty--;
 }
 
-bool ChessGameState::attacking_knight(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece_type) {
-    uint8_t attacked_piece = (uint8_t)attacked_piece_type + (is_white ? 6 : 0);
-    for (int new_rank = piece_square.rank-1; new_rank <= piece_square.rank+1; new_rank+=2)
-    {
-        for (int new_file = piece_square.file-2; new_file <= piece_square.file+2; new_file+=4)
-        {
-            if (is_square({new_rank, new_file}) && ChessGameState::current_position[new_rank][new_file] == attacked_piece) return true;
-        }
-    }
-    
-    for (int new_rank = piece_square.rank-2; new_rank <= piece_square.rank+2; new_rank+=4)
-    {
-        for (int new_file = piece_square.file-1; new_file <= piece_square.file+1; new_file+=2)
-        {
-            if (is_square({new_rank, new_file}) && ChessGameState::current_position[new_rank][new_file] == attacked_piece) return true;
-        }
-    }
+void ChessGameState::remove_piece(int sq) {
+    uint8_t piece = ChessGameState::current_position[sq / 8][sq % 8];
+    if (piece == 12) return;
 
-    return false;
+    uint64_t bb = Bitboard::square_bb(sq);
+    ChessGameState::current_position[sq / 8][sq % 8] = 12;
+    ChessGameState::piece_bb[piece] &= ~bb;
+    ChessGameState::color_bb[piece < 6 ? Bitboard::WHITE : Bitboard::BLACK] &= ~bb;
+    ChessGameState::occupied_bb &= ~bb;
+    ChessGameState::hash ^= Zobrist::KEYS.pieces[piece][sq];
+
+    ChessGameState::piece_count(piece)--;
+    ChessGameState::piece_counts.empty++;
 }
 
-bool ChessGameState::attacking_bishop(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece_type) {
-    uint8_t current_piece;
-    uint8_t attacked_piece = (uint8_t)attacked_piece_type + (is_white ? 6 : 0);
-    
-    // up right
-    for (int new_rank = 1; new_rank <= 7; new_rank++)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file + new_rank})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file + new_rank];
-            if (current_piece == attacked_piece) return true;
-            else if (current_piece == 12) continue;
-            else break;
-        }
-    }
+uint64_t ChessGameState::attackers_to(int sq, uint64_t occupied) const {
+    using namespace Bitboard;
 
-    // up left
-    for (int new_rank = 1; new_rank <= 7; new_rank++)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file - new_rank})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file - new_rank];
-            if (current_piece == attacked_piece) return true;
-            else if (current_piece == 12) continue;
-            else break;
-        }
-    }
+    uint64_t bishops = ChessGameState::piece_bb[2] | ChessGameState::piece_bb[4] | ChessGameState::piece_bb[8] | ChessGameState::piece_bb[10];
+    uint64_t rooks = ChessGameState::piece_bb[3] | ChessGameState::piece_bb[4] | ChessGameState::piece_bb[9] | ChessGameState::piece_bb[10];
 
-    // down left
-    for (int new_rank = -1; new_rank >= -7; new_rank--)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file + new_rank})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file + new_rank];
-            if (current_piece == attacked_piece) return true;
-            else if (current_piece == 12) continue;
-            else break;
-        }
-    }
-
-    // down right
-    for (int new_rank = -1; new_rank >= -7; new_rank--)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file - new_rank})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file - new_rank];
-            if (current_piece == attacked_piece) return true;
-            else if (current_piece == 12) continue;
-            else break;
-        }
-    }
+    return (PAWN_ATTACKS[BLACK][sq] & ChessGameState::piece_bb[0]) |
+        (PAWN_ATTACKS[WHITE][sq] & ChessGameState::piece_bb[6]) |
+        (KNIGHT_ATTACKS[sq] & (ChessGameState::piece_bb[1] | ChessGameState::piece_bb[7])) |
+        (KING_ATTACKS[sq] & (ChessGameState::piece_bb[5] | ChessGameState::piece_bb[11])) |
+        (bishop_attacks(sq, occupied) & bishops) |
+        (rook_attacks(sq, occupied) & rooks);
+}
 
-    return false;
+bool ChessGameState::is_attacked(int sq, bool by_white) const {
+    return ChessGameState::attackers_to(sq, ChessGameState::occupied_bb) & ChessGameState::color_bb[by_white ? Bitboard::WHITE : Bitboard::BLACK];
 }
-bool ChessGameState::attacking_rook(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece_type) {
-    uint8_t current_piece;
-    uint8_t attacked_piece = (uint8_t)attacked_piece_type + (is_white ? 6 : 0);
-    
-    // up
-    for (int new_rank = 1; new_rank <= 7; new_rank++)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file];
-            if (current_piece == attacked_piece) return true;
-            else if (current_piece == 12) continue;
-            else break;
-        }
-    }
 
-    // down
-    for (int new_rank = -1; new_rank >= -7; new_rank--)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file];
-            if (current_piece == attacked_piece) return true;
-            else if (current_piece == 12) continue;
-            else break;
-        }
-    }
+// Plays the move on a copy of the occupancy only, and checks the mover's king is not left attacked
+bool ChessGameState::is_king_safe_after(int from, int to, int captured_sq) const {
+    using namespace Bitboard;
 
-    // right
-    for (int new_file = 1; new_file <= 7; new_file++)
-    {
-        if (
-            is_square({piece_square.rank, piece_square.file + new_file})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank][piece_square.file + new_file];
-            if (current_piece == attacked_piece) return true;
-            else if (current_piece == 12) continue;
-            else break;
-        }
-    }
+    bool is_white = ChessGameState::flags & GameFlags::WHITE_TURN;
+    uint64_t removed = (captured_sq >= 0) ? square_bb(captured_sq) : 0;
+    uint64_t occupied = (ChessGameState::occupied_bb & ~square_bb(from) & ~removed) | square_bb(to);
 
-    // left
-    for (int new_file = -1; new_file >= -7; new_file--)
-    {
-        if (
-            is_square({piece_square.rank, piece_square.file + new_file})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank][piece_square.file + new_file];
-            if (current_piece == attacked_piece) return true;
-            else if (current_piece == 12) continue;
-            else break;
-        }
-    }
+    uint64_t king_bb = ChessGameState::piece_bb[is_white ? 5 : 11];
+    int king_sq = (king_bb & square_bb(from)) ? to : lsb(king_bb);
 
-    return false;
-}
-bool ChessGameState::attacking_queen(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece_type) {
-    if (ChessGameState::attacking_bishop(piece_square, is_white, attacked_piece_type)) return true;
-    if (ChessGameState::attacking_rook(piece_square, is_white, attacked_piece_type)) return true;
-    return false;
+    uint64_t enemies = ChessGameState::color_bb[is_white ? BLACK : WHITE] & ~removed;
+    return !(ChessGameState::attackers_to(king_sq, occupied) & enemies);
 }
 
-bool ChessGameState::attacking_king(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece_type) {
-    uint8_t attacked_piece = (uint8_t)attacked_piece_type + (is_white ? 6 : 0);
-
-    for (int new_rank = -1; new_rank <= 1; new_rank++)
-    {
-        for (int new_file = -1; new_file <= 1; new_file++)
-        {
-            if (
-                is_square({piece_square.rank+new_rank, piece_square.file+new_file}) &&
-                ChessGameState::current_position[piece_square.rank+new_rank][piece_square.file+new_file] == attacked_piece
-            ) return true;
-        }
+// Own pieces standing alone between the king and an enemy slider; they may only move along that line
+uint64_t ChessGameState::pinned_pieces(int king_sq) const {
+    using namespace Bitboard;
+
+    bool is_white = ChessGameState::flags & GameFlags::WHITE_TURN;
+    uint8_t enemy_base = is_white ? 6 : 0;
+    uint64_t own = ChessGameState::color_bb[is_white ? WHITE : BLACK];
+    uint64_t enemies = ChessGameState::color_bb[is_white ? BLACK : WHITE];
+
+    uint64_t enemy_queens = ChessGameState::piece_bb[enemy_base + PieceTypes::QUEEN];
+    uint64_t snipers =
+        (rook_attacks(king_sq, enemies) & (ChessGameState::piece_bb[enemy_base + PieceTypes::ROOK] | enemy_queens)) |
+        (bishop_attacks(king_sq, enemies) & (ChessGameState::piece_bb[enemy_base + PieceTypes::BISHOP] | enemy_queens));
+
+    uint64_t pinned = 0;
+    while (snipers) {
+        int sniper = pop_lsb(snipers);
+        uint64_t blockers = BETWEEN[king_sq][sniper] & ChessGameState::occupied_bb;
+        if (count(blockers) == 1 && (blockers & own)) pinned |= blockers;
     }
-
-    return false;
+    return pinned;
 }
 
-bool ChessGameState::is_attacked(ChessSquare piece_square, bool is_white) {
-    // check pawns
-    if (ChessGameState::attacking_pawn(piece_square, is_white, PieceTypes::PAWN)) return true;
-    
-    // check knights
-    if (ChessGameState::attacking_knight(piece_square, is_white, PieceTypes::KNIGHT)) return true;
-    
-    // check bishops
-    if (ChessGameState::attacking_bishop(piece_square, is_white, PieceTypes::BISHOP)) return true;
-    
-    // check rooks
-    if (ChessGameState::attacking_rook(piece_square, is_white, PieceTypes::ROOK)) return true;
-    
-    // check queens
-    if (ChessGameState::attacking_queen(piece_square, is_white, PieceTypes::QUEEN)) return true;
+void ChessGameState::add_move(vector<ChessMove>& moves, int from, int to, MoveFlags move_flags) const {
+    if (move_flags != MoveFlags::PROMOTION_MOVE) {
+        moves.emplace_back(from, to, move_flags);
+        return;
+    }
 
-    return false;
+    moves.emplace_back(from, to, move_flags, PromotionPieceType::PROMOTED_KNIGHT);
+    moves.emplace_back(from, to, move_flags, PromotionPieceType::PROMOTED_BISHOP);
+    moves.emplace_back(from, to, move_flags, PromotionPieceType::PROMOTED_ROOK);
+    moves.emplace_back(from, to, move_flags, PromotionPieceType::PROMOTED_QUEEN);
 }
 
-bool ChessGameState::legal_to_go(ChessSquare to_sq, bool is_white) {
-    return (is_white && ChessGameState::current_position[to_sq.rank][to_sq.file] >= 6) ||
-        (!is_white && ChessGameState::current_position[to_sq.rank][to_sq.file] < 6) ||
-        (ChessGameState::current_position[to_sq.rank][to_sq.file] == 12);
+void ChessGameState::add_moves(vector<ChessMove>& moves, int from, uint64_t targets, MoveFlags move_flags) const {
+    while (targets) {
+        ChessGameState::add_move(moves, from, Bitboard::pop_lsb(targets), move_flags);
+    }
 }
 
-void ChessGameState::legal_moves_pawn(ChessSquare piece_square, bool is_white) {
-    int rank_diff = is_white ? 1 : -1;
-    ChessGameState* new_pos;
-    if (
-        is_square({piece_square.rank+rank_diff, piece_square.file+1}) &&
-        (
-            (
-                ChessGameState::current_position[piece_square.rank+rank_diff][piece_square.file+1] != 12 &&
-                legal_to_go({piece_square.rank+rank_diff, piece_square.file+1}, is_white)
-            ) ||
-            (
-                ChessGameState::enpassant_sq.rank == piece_square.rank+rank_diff &&
-                ChessGameState::enpassant_sq.file == piece_square.file+1 &&
-                (ChessGameState::flags & GameFlags::EN_PASSANT)
-            )
-        )
-    ) {
-        if (!(piece_square.rank+rank_diff == 0 || piece_square.rank+rank_diff == 7)) {
-            try {
-                ChessMove move(piece_square, {piece_square.rank+rank_diff, piece_square.file+1});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-        } else {
-            vector<PromotionPieceType> piece_types = {PromotionPieceType::PROMOTED_KNIGHT, PromotionPieceType::PROMOTED_BISHOP, PromotionPieceType::PROMOTED_ROOK, PromotionPieceType::PROMOTED_QUEEN};
-
-            for (PromotionPieceType promotion_type : piece_types) {
-                try {
-                    ChessMove move(piece_square, {piece_square.rank+rank_diff, piece_square.file+1}, promotion_type);
-                    new_pos = GameStateFactory::create_state(this, move);
-                    ChessGameState::add_child(new_pos, move);
-                } catch (...) {}
-            }
-        }
+// Legal moves only: check and pin masks are computed once for the position, so pseudo-legal
+// moves are filtered with bitwise ands. Only en passant (which can uncover a rank attack on
+// the king) is verified by replaying it on the occupancy.
+void ChessGameState::generate_legal_moves(vector<ChessMove>& moves) const {
+    using namespace Bitboard;
+
+    bool is_white = ChessGameState::flags & GameFlags::WHITE_TURN;
+    Color us = is_white ? WHITE : BLACK;
+    uint8_t base = is_white ? 0 : 6;
+
+    uint64_t own = ChessGameState::color_bb[us];
+    uint64_t enemies = ChessGameState::color_bb[is_white ? BLACK : WHITE];
+    uint64_t empty = ~ChessGameState::occupied_bb;
+
+    int king_sq = lsb(ChessGameState::piece_bb[base + PieceTypes::KING]);
+    uint64_t checkers = ChessGameState::attackers_to(king_sq, ChessGameState::occupied_bb) & enemies;
+    uint64_t pinned = ChessGameState::pinned_pieces(king_sq);
+
+    // king: target must not be attacked once the king has left its square (it can't block a slider on itself)
+    uint64_t occupied_without_king = ChessGameState::occupied_bb & ~square_bb(king_sq);
+    uint64_t king_targets = KING_ATTACKS[king_sq] & ~own;
+    while (king_targets) {
+        int to = pop_lsb(king_targets);
+        if (!(ChessGameState::attackers_to(to, occupied_without_king) & enemies))
+            ChessGameState::add_move(moves, king_sq, to);
     }
 
-    if (
-        is_square({piece_square.rank+rank_diff, piece_square.file-1}) &&
-        (
-            (
-                ChessGameState::current_position[piece_square.rank+rank_diff][piece_square.file-1] != 12 &&
-                legal_to_go({piece_square.rank+rank_diff, piece_square.file-1}, is_white)
-            ) ||
-            (
-                ChessGameState::enpassant_sq.rank == piece_square.rank+rank_diff &&
-                ChessGameState::enpassant_sq.file == piece_square.file-1 &&
-                (ChessGameState::flags & GameFlags::EN_PASSANT)
-            )
-        )
-    ) {
-        if (!(piece_square.rank+rank_diff == 0 || piece_square.rank+rank_diff == 7)) {
-            try {
-                ChessMove move(piece_square, {piece_square.rank+rank_diff, piece_square.file-1});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-        } else {
-            vector<PromotionPieceType> piece_types = {PromotionPieceType::PROMOTED_KNIGHT, PromotionPieceType::PROMOTED_BISHOP, PromotionPieceType::PROMOTED_ROOK, PromotionPieceType::PROMOTED_QUEEN};
-
-            for (PromotionPieceType promotion_type : piece_types) {
-                try {
-                    ChessMove move(piece_square, {piece_square.rank+rank_diff, piece_square.file-1}, promotion_type);
-                    new_pos = GameStateFactory::create_state(this, move);
-                    ChessGameState::add_child(new_pos, move);
-                } catch (...) {}
-            }
-        }
-    }
+    // double check: only the king can move
+    if (count(checkers) > 1) return;
 
-    if (
-        is_square({piece_square.rank+rank_diff, piece_square.file}) &&
-        ChessGameState::current_position[piece_square.rank+rank_diff][piece_square.file] == 12
-    ) {
-        if (!(piece_square.rank+rank_diff == 0 || piece_square.rank+rank_diff == 7)) {
-            try {
-                ChessMove move(piece_square, {piece_square.rank+rank_diff, piece_square.file});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-        } else {
-            vector<PromotionPieceType> piece_types = {PromotionPieceType::PROMOTED_KNIGHT, PromotionPieceType::PROMOTED_BISHOP, PromotionPieceType::PROMOTED_ROOK, PromotionPieceType::PROMOTED_QUEEN};
-
-            for (PromotionPieceType promotion_type : piece_types) {
-                try {
-                    ChessMove move(piece_square, {piece_square.rank+rank_diff, piece_square.file}, promotion_type);
-                    new_pos = GameStateFactory::create_state(this, move);
-                    ChessGameState::add_child(new_pos, move);
-                } catch (...) {}
-            }
-        }
+    // single check: other pieces must capture the checker or block it
+    uint64_t check_mask = checkers ? (BETWEEN[king_sq][lsb(checkers)] | checkers) : ~0ULL;
 
+    // pawns
+    int push = is_white ? 8 : -8;
+    uint64_t double_push_rank = is_white ? (RANK_1 << 8) : (RANK_1 << 48);
+    uint64_t promotion_rank = is_white ? RANK_8 : RANK_1;
+    int enpassant = (ChessGameState::flags & GameFlags::EN_PASSANT) ? square_index(ChessGameState::enpassant_sq) : -1;
 
-        if (
-            is_square({piece_square.rank+(2*rank_diff), piece_square.file}) &&
-            ChessGameState::current_position[piece_square.rank+(2*rank_diff)][piece_square.file] == 12 &&
-            (piece_square.rank == 1 || piece_square.rank == 6)
-        ) {
-            try {
-                ChessMove move(piece_square, {piece_square.rank+(2*rank_diff), piece_square.file});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-        }
-    }
-}
-void ChessGameState::legal_moves_knight(ChessSquare piece_square, bool is_white) {
-    ChessGameState* new_pos;
-    for (int new_rank = piece_square.rank-1; new_rank <= piece_square.rank+1; new_rank+=2)
-    {
-        for (int new_file = piece_square.file-2; new_file <= piece_square.file+2; new_file+=4)
-        {
-            if (is_square({new_rank, new_file}) && ChessGameState::legal_to_go({new_rank, new_file}, is_white)) {
-                try {
-                    ChessMove move(piece_square, {new_rank, new_file});
-                    new_pos = GameStateFactory::create_state(this, move);
-                    ChessGameState::add_child(new_pos, move);
-                } catch (...) {}
-            }
-        }
-    }
-    
-    for (int new_rank = piece_square.rank-2; new_rank <= piece_square.rank+2; new_rank+=4)
-    {
-        for (int new_file = piece_square.file-1; new_file <= piece_square.file+1; new_file+=2)
-        {
-            if (is_square({new_rank, new_file}) && ChessGameState::legal_to_go({new_rank, new_file}, is_white)) {
-                try {
-                    ChessMove move(piece_square, {new_rank, new_file});
-                    new_pos = GameStateFactory::create_state(this, move);
-                    ChessGameState::add_child(new_pos, move);
-                } catch (...) {}
-            }
-        }
-    }
-}
-void ChessGameState::legal_moves_bishop(ChessSquare piece_square, bool is_white) {
-    uint8_t current_piece;
-    ChessGameState* new_pos;
-    
-    // up right
-    for (int new_rank = 1; new_rank <= 7; new_rank++)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file + new_rank})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file + new_rank];
-            if (!ChessGameState::legal_to_go({piece_square.rank + new_rank, piece_square.file + new_rank}, is_white)) break;
-            
-            try {
-                ChessMove move(piece_square, {piece_square.rank+new_rank, piece_square.file+new_rank});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
+    uint64_t pawns = ChessGameState::piece_bb[base + PieceTypes::PAWN];
+    while (pawns) {
+        int from = pop_lsb(pawns);
+        uint64_t pin_mask = (pinned & square_bb(from)) ? LINE[king_sq][from] : ~0ULL;
 
-            if (current_piece != 12) break;
+        uint64_t targets = PAWN_ATTACKS[us][from] & enemies;
+        int to = from + push;
+        if (empty & square_bb(to)) {
+            targets |= square_bb(to);
+            if ((double_push_rank & square_bb(from)) && (empty & square_bb(to + push))) targets |= square_bb(to + push);
         }
-    }
-
-    // up left
-    for (int new_rank = 1; new_rank <= 7; new_rank++)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file - new_rank})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file - new_rank];
-            if (!ChessGameState::legal_to_go({piece_square.rank + new_rank, piece_square.file - new_rank}, is_white)) break;
-            
-            try {
-                ChessMove move(piece_square, {piece_square.rank+new_rank, piece_square.file-new_rank});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
+        targets &= check_mask & pin_mask;
 
-            if (current_piece != 12) break;
-        }
-    }
+        ChessGameState::add_moves(moves, from, targets & ~promotion_rank);
+        ChessGameState::add_moves(moves, from, targets & promotion_rank, MoveFlags::PROMOTION_MOVE);
 
-    // down left
-    for (int new_rank = -1; new_rank >= -7; new_rank--)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file + new_rank})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file + new_rank];
-            if (!ChessGameState::legal_to_go({piece_square.rank + new_rank, piece_square.file + new_rank}, is_white)) break;
-            
-            try {
-                ChessMove move(piece_square, {piece_square.rank+new_rank, piece_square.file+new_rank});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-            
-            if (current_piece != 12) break;
-        }
+        if (enpassant >= 0 && (PAWN_ATTACKS[us][from] & square_bb(enpassant)) && ChessGameState::is_king_safe_after(from, enpassant, enpassant - push))
+            ChessGameState::add_move(moves, from, enpassant, MoveFlags::EN_PASSANT_MOVE);
     }
 
-    // down right
-    for (int new_rank = -1; new_rank >= -7; new_rank--)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file - new_rank})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file - new_rank];
-            if (!ChessGameState::legal_to_go({piece_square.rank + new_rank, piece_square.file - new_rank}, is_white)) break;
-            
-            try {
-                ChessMove move(piece_square, {piece_square.rank+new_rank, piece_square.file-new_rank});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
+    // pieces
+    for (int piece_type = PieceTypes::KNIGHT; piece_type <= PieceTypes::QUEEN; piece_type++) {
+        uint64_t pieces = ChessGameState::piece_bb[base + piece_type];
+        while (pieces) {
+            int from = pop_lsb(pieces);
+            uint64_t pin_mask = (pinned & square_bb(from)) ? LINE[king_sq][from] : ~0ULL;
 
-            if (current_piece != 12) break;
-        }
-    }
-}
-void ChessGameState::legal_moves_rook(ChessSquare piece_square, bool is_white) {
-    uint8_t current_piece;
-    ChessGameState* new_pos;
-    
-    // up
-    for (int new_rank = 1; new_rank <= 7; new_rank++)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file];
-            if (!ChessGameState::legal_to_go({piece_square.rank + new_rank, piece_square.file}, is_white)) break;
-            
-            try {
-                ChessMove move(piece_square, {piece_square.rank+new_rank, piece_square.file});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
+            uint64_t attacks;
+            switch (piece_type)
+            {
+            case PieceTypes::KNIGHT:
+                attacks = KNIGHT_ATTACKS[from];
+                break;
+            case PieceTypes::BISHOP:
+                attacks = bishop_attacks(from, ChessGameState::occupied_bb);
+                break;
+            case PieceTypes::ROOK:
+                attacks = rook_attacks(from, ChessGameState::occupied_bb);
+                break;
+            default:
+                attacks = queen_attacks(from, ChessGameState::occupied_bb);
+                break;
+            }
 
-            if (current_piece != 12) break;
+            ChessGameState::add_moves(moves, from, attacks & ~own & check_mask & pin_mask);
         }
     }
 
-    // down
-    for (int new_rank = -1; new_rank >= -7; new_rank--)
-    {
-        if (
-            is_square({piece_square.rank + new_rank, piece_square.file})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank + new_rank][piece_square.file];
-            if (!ChessGameState::legal_to_go({piece_square.rank + new_rank, piece_square.file}, is_white)) break;
-            
-            try {
-                ChessMove move(piece_square, {piece_square.rank+new_rank, piece_square.file});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
+    // castling: king and rook on their home squares, path empty, king not in check nor passing through an attacked square
+    if (checkers) return;
 
-            if (current_piece != 12) break;
-        }
-    }
+    uint16_t king_castle = is_white ? GameFlags::WHITE_KING_CASTLE : GameFlags::BLACK_KING_CASTLE;
+    uint16_t queen_castle = is_white ? GameFlags::WHITE_QUEEN_CASTLE : GameFlags::BLACK_QUEEN_CASTLE;
+    uint64_t rooks = ChessGameState::piece_bb[base + PieceTypes::ROOK];
 
-    // right
-    for (int new_file = 1; new_file <= 7; new_file++)
-    {
-        if (
-            is_square({piece_square.rank, piece_square.file + new_file})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank][piece_square.file + new_file];
-            if (!ChessGameState::legal_to_go({piece_square.rank, piece_square.file + new_file}, is_white)) break;
-            
-            try {
-                ChessMove move(piece_square, {piece_square.rank, piece_square.file+new_file});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
+    if (!(ChessGameState::flags & (king_castle | queen_castle))) return;
+    if (king_sq != (is_white ? 4 : 60)) return;
 
-            if (current_piece != 12) break;
-        }
-    }
-
-    // left
-    for (int new_file = -1; new_file >= -7; new_file--)
-    {
-        if (
-            is_square({piece_square.rank, piece_square.file + new_file})
-        ) {
-            current_piece = ChessGameState::current_position[piece_square.rank][piece_square.file + new_file];
-            if (!ChessGameState::legal_to_go({piece_square.rank, piece_square.file + new_file}, is_white)) break;
-            
-            try {
-                ChessMove move(piece_square, {piece_square.rank, piece_square.file+new_file});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
+    if (
+        (ChessGameState::flags & king_castle) &&
+        (rooks & square_bb(king_sq + 3)) &&
+        !(ChessGameState::occupied_bb & (square_bb(king_sq + 1) | square_bb(king_sq + 2))) &&
+        !ChessGameState::is_attacked(king_sq + 1, !is_white) &&
+        !ChessGameState::is_attacked(king_sq + 2, !is_white)
+    ) ChessGameState::add_move(moves, king_sq, king_sq + 2, MoveFlags::CASTLING_MOVE);
 
-            if (current_piece != 12) break;
-        }
-    }
-}
-void ChessGameState::legal_moves_queen(ChessSquare piece_square, bool is_white) {
-    ChessGameState::legal_moves_bishop(piece_square, is_white);
-    ChessGameState::legal_moves_rook(piece_square, is_white);
+    if (
+        (ChessGameState::flags & queen_castle) &&
+        (rooks & square_bb(king_sq - 4)) &&
+        !(ChessGameState::occupied_bb & (square_bb(king_sq - 1) | square_bb(king_sq - 2) | square_bb(king_sq - 3))) &&
+        !ChessGameState::is_attacked(king_sq - 1, !is_white) &&
+        !ChessGameState::is_attacked(king_sq - 2, !is_white)
+    ) ChessGameState::add_move(moves, king_sq, king_sq - 2, MoveFlags::CASTLING_MOVE);
 }
-void ChessGameState::legal_moves_king(ChessSquare piece_square, bool is_white) {
-    ChessGameState* new_pos;
-    for (int new_rank = -1; new_rank <= 1; new_rank++)
-    {
-        for (int new_file = -1; new_file <= 1; new_file++)
-        {
-            if (
-                is_square({piece_square.rank+new_rank, piece_square.file+new_file}) &&
-                ChessGameState::legal_to_go({piece_square.rank+new_rank, piece_square.file+new_file}, is_white) &&
-                !(new_rank == 0 && new_file == 0)
-            ) {
-                try {
-                    ChessMove move(piece_square, {piece_square.rank+new_rank, piece_square.file+new_file});
-                    new_pos = GameStateFactory::create_state(this, move);
-                    ChessGameState::add_child(new_pos, move);
-                } catch (...) {}
-            }
-        }
-    }
 
-    if (is_white && (ChessGameState::flags & GameFlags::WHITE_KING_CASTLE)) {
-        if (ChessGameState::current_position[0][5] == 12 && ChessGameState::current_position[0][6] == 12) {
-            try {
-                ChessMove move(piece_square, {0,6});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-        }
-    }
+void ChessGameState::compute_moves() {
+    ChessGameState::children.clear();
 
-    if (is_white && (ChessGameState::flags & GameFlags::WHITE_QUEEN_CASTLE)) {
-        if (ChessGameState::current_position[0][3] == 12 && ChessGameState::current_position[0][2] == 12 && ChessGameState::current_position[0][1] == 12) {
-            try {
-                ChessMove move(piece_square, {0,2});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-        }
-    }
+    // reused between calls, only the children array itself is allocated per expansion
+    static thread_local vector<ChessMove> moves;
+    moves.clear();
+    ChessGameState::generate_legal_moves(moves);
+    ChessGameState::children.reserve(moves.size());
 
-    if (!is_white && (ChessGameState::flags & GameFlags::BLACK_KING_CASTLE)) {
-        if (ChessGameState::current_position[7][5] == 12 && ChessGameState::current_position[7][6] == 12) {
-            try {
-                ChessMove move(piece_square, {7,6});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-        }
+    for (const ChessMove& move : moves) {
+        ChessGameState::add_child(nullptr, move);
     }
 
-    if (!is_white && (ChessGameState::flags & GameFlags::BLACK_QUEEN_CASTLE)) {
-        if (ChessGameState::current_position[7][3] == 12 && ChessGameState::current_position[7][2] == 12 && ChessGameState::current_position[7][1] == 12) {
-            try {
-                ChessMove move(piece_square, {7,2});
-                new_pos = GameStateFactory::create_state(this, move);
-                ChessGameState::add_child(new_pos, move);
-            } catch (...) {}
-        }
-    }
+    ChessGameState::flags |= GameFlags::MOVES_COMPUTED;
 }
 
 void ChessGameState::compute_children() {
-    bool is_white_turn = ChessGameState::flags & GameFlags::WHITE_TURN;
+    if (!(ChessGameState::flags & GameFlags::MOVES_COMPUTED)) ChessGameState::compute_moves();
 
-    ChessGameState::children.clear();
-
-    uint8_t cell;
-    PieceTypes piece_type;
-    for (int rank = 0; rank < 8; rank++)
-    {
-        for (int file = 0; file < 8; file++)
-        {
-            cell = ChessGameState::current_position[rank][file];
-            if (cell == 12) continue;
-
-            if ((is_white_turn && cell < 6) || (!is_white_turn && cell >= 6)) {
-                piece_type = (PieceTypes)(cell%6);
-                switch (piece_type)
-                {
-                case PieceTypes::PAWN:
-                    ChessGameState::legal_moves_pawn({rank, file}, is_white_turn);
-                    break;
-                
-                case PieceTypes::KNIGHT:
-                    ChessGameState::legal_moves_knight({rank, file}, is_white_turn);
-                    break;
-                
-                case PieceTypes::BISHOP:
-                    ChessGameState::legal_moves_bishop({rank, file}, is_white_turn);
-                    break;
-
-                case PieceTypes::ROOK:
-                    ChessGameState::legal_moves_rook({rank, file}, is_white_turn);
-                    break;
-
-                case PieceTypes::QUEEN:
-                    ChessGameState::legal_moves_queen({rank, file}, is_white_turn);
-                    break;
-                
-                case PieceTypes::KING:
-                    ChessGameState::legal_moves_king({rank, file}, is_white_turn);
-                    break;
-                
-                default:
-                    break;
-                }
-            }
-        }
+    for (auto& [move, state] : ChessGameState::children) {
+        if (state == nullptr) state = GameStateFactory::create_child(this, move);
     }
 
     ChessGameState::flags |= GameFlags::CHILDREN_COMPUTED;
 }
-
 // --------------------------------------------------
 
+// fewer states than this are never collected
+static const size_t MIN_COLLECT_THRESHOLD = 1 << 14;
+
 GameStateFactory::Registry GameStateFactory::registry = {
-    vector<ChessGameState*>(0)
+    Utils::Pool<ChessGameState>(1024),
+    vector<ChessGameState*>(0),
+    vector<ChessGameState*>(0),
+    0,
+    0,
+    MIN_COLLECT_THRESHOLD
 };
 
 GameStateFactory::Registry::~Registry() {
     for (auto ptr : GameStateFactory::registry.states) {
         try {
-            delete ptr;
+            GameStateFactory::registry.pool.destroy(ptr);
         } catch (...) {}
     }
 }
@@ -1392,16 +927,106 @@ ChessGameState* GameStateFactory::get_state() {
     return NULL;
 }
 
-ChessGameState* GameStateFactory::create_state(ChessGameState* position, ChessMove move) {
-    ChessGameState* new_position = new ChessGameState(*position, move);
+ChessGameState* GameStateFactory::intern(const ChessGameState& position) {
+    vector<ChessGameState*>& table = GameStateFactory::registry.interned;
+    if (!table.empty()) {
+        size_t mask = table.size() - 1;
+        for (size_t i = position.get_hash() & mask; table[i] != nullptr; i = (i + 1) & mask) {
+            if (table[i]->get_hash() == position.get_hash() && table[i]->is_same_position(position)) return table[i];
+        }
+    }
 
+    ChessGameState* new_position = GameStateFactory::registry.pool.create(position);
     GameStateFactory::registry.states.push_back(new_position);
+    GameStateFactory::insert_interned(new_position);
 
     return new_position;
 }
 
+void GameStateFactory::insert_interned(ChessGameState* state) {
+    vector<ChessGameState*>& table = GameStateFactory::registry.interned;
+
+    // keep the load factor under 1/2
+    if (GameStateFactory::registry.states.size() * 2 > table.size()) {
+        vector<ChessGameState*> old_table(max<size_t>(table.size() * 2, 1024), nullptr);
+        old_table.swap(table);
+        GameStateFactory::registry.table_allocations++;
+        for (ChessGameState* old : old_table) {
+            if (old != nullptr && old != state) GameStateFactory::insert_interned(old);
+        }
+    }
+
+    size_t mask = table.size() - 1;
+    size_t i = state->get_hash() & mask;
+    while (table[i] != nullptr) i = (i + 1) & mask;
+    table[i] = state;
+}
+
+ChessGameState* GameStateFactory::create_state(ChessGameState* position, ChessMove move) {
+    return GameStateFactory::intern(ChessGameState(*position, move));
+}
+
+ChessGameState* GameStateFactory::create_child(ChessGameState* position, ChessMove move) {
+    return GameStateFactory::intern(ChessGameState(*position, move, false));
+}
+
 ChessGameState* GameStateFactory::create_state(string fen) {
-    ChessGameState* new_position = new ChessGameState(fen);
-    GameStateFactory::registry.states.push_back(new_position);
-    return new_position;
-}
\ No newline at end of file
+    return GameStateFactory::intern(ChessGameState(fen));
+}
+
+void GameStateFactory::retain(ChessGameState* state) {
+    state->ref_count++;
+}
+
+void GameStateFactory::release(ChessGameState* state) {
+    state->ref_count--;
+}
+
+void GameStateFactory::collect(bool is_forced) {
+    vector<ChessGameState*>& states = GameStateFactory::registry.states;
+    if (!is_forced && states.size() < GameStateFactory::registry.collect_threshold) return;
+    uint32_t generation = ++GameStateFactory::registry.generation;
+
+    // mark: retained states and their cached children (so beam positions keep their expansion)
+    for (ChessGameState* state : states) {
+        if (state->ref_count == 0) continue;
+        state->mark = generation;
+        for (const auto& [mv, child] : state->children) {
+            if (child != nullptr) child->mark = generation;
+        }
+    }
+
+    // unlink survivors from what is about to be freed
+    for (ChessGameState* state : states) {
+        if (state->mark != generation) continue;
+        if (state->parent != nullptr && state->parent->mark != generation) state->parent = nullptr;
+        if (state->ref_count == 0 && (state->flags & GameFlags::MOVES_COMPUTED)) {
+            vector<pair<ChessMove, ChessGameState*>>().swap(state->children);
+            state->flags &= ~(GameFlags::CHILDREN_COMPUTED | GameFlags::MOVES_COMPUTED);
+        }
+    }
+
+    // sweep
+    size_t kept = 0;
+    for (ChessGameState* state : states) {
+        if (state->mark == generation) {
+            states[kept++] = state;
+            continue;
+        }
+        GameStateFactory::registry.pool.destroy(state);
+    }
+    states.resize(kept);
+    GameStateFactory::registry.collect_threshold = max(MIN_COLLECT_THRESHOLD, 2 * kept);
+
+    // rebuilding is linear in the table size, cheaper than a backward shift per freed state
+    fill(GameStateFactory::registry.interned.begin(), GameStateFactory::registry.interned.end(), nullptr);
+    for (ChessGameState* state : states) GameStateFactory::insert_interned(state);
+}
+
+size_t GameStateFactory::size() {
+    return GameStateFactory::registry.states.size();
+}
+
+size_t GameStateFactory::allocations() {
+    return GameStateFactory::registry.pool.allocations() + GameStateFactory::registry.table_allocations;
+}
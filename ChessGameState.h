@@ -2,6 +2,8 @@
 #include <vector>
 #include <cstdint>
 #include <map>
+#include "Bitboard.h"
+#include "Utils/Arena.h"
 
 using namespace std;
 
@@ -35,13 +37,38 @@ enum PromotionPieceType {
     PROMOTED_QUEEN = PieceTypes::QUEEN,
 };
 
+enum MoveFlags {
+    NORMAL_MOVE = 0,
+    PROMOTION_MOVE = 1,
+    EN_PASSANT_MOVE = 2,
+    CASTLING_MOVE = 3,
+};
+
+/**
+ * Move packed in 16 bits:
+ *   bits 0-5   from square (rank * 8 + file)
+ *   bits 6-11  to square
+ *   bits 12-13 promotion piece (knight, bishop, rook, queen)
+ *   bits 14-15 MoveFlags, set by the move generator (moves built from squares are NORMAL_MOVE)
+ * SAN strings are only built for output. Comparisons ignore the flags.
+ */
 class ChessMove {
     friend class ChessGameState;
     
     public:
+        ChessMove(); // null move (a1 to a1), e.g. for self loops
         ChessMove(string from_sq, string to_sq);
         ChessMove(ChessSquare from_sq, ChessSquare to_sq);
         ChessMove(ChessSquare from_sq, ChessSquare to_sq, PromotionPieceType promotion_type);
+        ChessMove(int from, int to, MoveFlags flags = MoveFlags::NORMAL_MOVE, PromotionPieceType promotion_type = PromotionPieceType::PROMOTED_QUEEN);
+
+        int from() const;
+        int to() const;
+        ChessSquare from_square() const;
+        ChessSquare to_square() const;
+        PromotionPieceType promotion() const;
+        MoveFlags flags() const;
+        bool is_null() const;
 
         string str() const;
 
@@ -51,13 +78,7 @@ class ChessMove {
         bool operator==(const ChessMove& other) const;
     
     private:
-        string from_san;
-        string to_san;
-
-        ChessSquare from_sq;
-        ChessSquare to_sq;
-
-        PromotionPieceType promotion_type = PromotionPieceType::PROMOTED_QUEEN; // TODO: set in constructor
+        uint16_t data;
 };
 
 enum GameFlags {
@@ -76,7 +97,8 @@ enum GameFlags {
     IS_GAME_OVER = 1 << 8,
 
     IS_LEGAL = 1 << 9,
-    CHILDREN_COMPUTED = 1 << 10,
+    CHILDREN_COMPUTED = 1 << 10, // every child position created
+    MOVES_COMPUTED = 1 << 11,    // legal moves known, child positions created on demand
 };
 
 struct PieceHistogram {
@@ -97,78 +119,156 @@ struct PieceHistogram {
     uint8_t empty = 0;
 };
 
+enum class MoveStatus {
+    LEGAL,
+    NO_PIECE,      // from square is empty
+    WRONG_TURN,    // piece belongs to the side not to move
+    ILLEGAL,       // not a legal move for this piece (blocked, leaves king in check, ...)
+};
+
+class ChessGameState;
+
+struct MoveResult {
+    MoveStatus status;
+    ChessGameState* state = nullptr; // only set when status == LEGAL
+};
+
 static const string STARTING_POSITION_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 class ChessGameState {
     friend class HMMState;
+    friend struct HMMObservation;
     friend class ChessHMM;
+    friend class GameStateFactory;
     public:
         ChessGameState(string fen = STARTING_POSITION_FEN);
         ChessGameState(const ChessGameState& other, ChessMove move);
         ~ChessGameState();
 
         void eval_next();
+        // legal moves only, child positions are created by get_child
+        void eval_moves();
 
         string get_fen();
 
+        // with interning this is the position the state was first reached from,
+        // null once that position was freed by GameStateFactory::collect
         const ChessGameState* get_parent();
 
+        uint64_t get_hash() const;
+        bool is_same_position(const ChessGameState& other) const;
+
         vector<ChessMove> get_legal_moves();
         vector<ChessGameState*> get_children();
 
+        // get_children() in two steps, for expanding many positions in parallel:
+        // generate_children is thread safe (builds the positions without interning them),
+        // set_children interns them as this state's children and is not
+        void generate_children(vector<pair<ChessMove, ChessGameState>>& children) const;
+        void set_children(const vector<pair<ChessMove, ChessGameState>>& children);
+        bool is_expanded() const;
+
+        // position after the index-th legal move (eval_moves order), created on first use
+        ChessGameState* get_child(size_t index);
+
         ChessGameState* move(ChessMove move);
+        MoveResult try_make_move(ChessMove move);
+
+        // leaf count of the legal move tree, positions are built on the stack (no interning, no caching)
+        uint64_t perft(int depth) const;
         
         string str();
         string repr();
 
     private:
+        ChessGameState(const ChessGameState& other, ChessMove move, bool validate);
+
         string fen;
         const ChessGameState* parent;
         uint8_t current_position[8][8];
         uint16_t flags = 0; // up to 16 flags
 
+        // bitboards kept in sync with current_position
+        uint64_t piece_bb[12] = {0};
+        uint64_t color_bb[2] = {0}; // [Bitboard::WHITE], [Bitboard::BLACK]
+        uint64_t occupied_bb = 0;
+
+        // zobrist key of board + side + castling + en passant, updated incrementally
+        uint64_t hash = 0;
+
+        // owners holding this state (HMM nodes), see GameStateFactory::collect
+        uint32_t ref_count = 0;
+        uint32_t mark = 0;
+
         ChessSquare enpassant_sq;
 
         PieceHistogram piece_counts;
 
-        map<ChessMove, ChessGameState*> children;
+        // legal moves in generation order, each with its resulting position (null until created)
+        vector<pair<ChessMove, ChessGameState*>> children;
 
         void parse_fen(string fen);
         bool is_valid();
 
         void add_child(ChessGameState* new_pos, ChessMove move);
 
-        bool attacking_pawn(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece = PieceTypes::KING);
-        bool attacking_knight(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece = PieceTypes::KING);
-        bool attacking_bishop(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece = PieceTypes::KING);
-        bool attacking_rook(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece = PieceTypes::KING);
-        bool attacking_queen(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece = PieceTypes::KING);
-        bool attacking_king(ChessSquare piece_square, bool is_white, PieceTypes attacked_piece = PieceTypes::KING);
+        void put_piece(int sq, uint8_t piece);
+        void remove_piece(int sq);
+        uint8_t& piece_count(uint8_t piece);
+        uint64_t flags_hash() const;
 
-        bool is_attacked(ChessSquare piece_square, bool is_white);
+        uint64_t attackers_to(int sq, uint64_t occupied) const;
+        bool is_attacked(int sq, bool by_white) const;
+        bool is_king_safe_after(int from, int to, int captured_sq) const;
+        uint64_t pinned_pieces(int king_sq) const;
 
-        bool legal_to_go(ChessSquare to_sq, bool is_white);
-
-        void legal_moves_pawn(ChessSquare piece_square, bool is_white);
-        void legal_moves_knight(ChessSquare piece_square, bool is_white);
-        void legal_moves_bishop(ChessSquare piece_square, bool is_white);
-        void legal_moves_rook(ChessSquare piece_square, bool is_white);
-        void legal_moves_queen(ChessSquare piece_square, bool is_white);
-        void legal_moves_king(ChessSquare piece_square, bool is_white);
+        void add_move(vector<ChessMove>& moves, int from, int to, MoveFlags move_flags = MoveFlags::NORMAL_MOVE) const;
+        void add_moves(vector<ChessMove>& moves, int from, uint64_t targets, MoveFlags move_flags = MoveFlags::NORMAL_MOVE) const;
+        void generate_legal_moves(vector<ChessMove>& moves) const;
 
+        void compute_moves();
         void compute_children();
 };
 
 class GameStateFactory {
+    friend class ChessGameState;
     public:
         ChessGameState* get_state();
 
         static ChessGameState* create_state(ChessGameState* position, ChessMove move);
         static ChessGameState* create_state(string fen);
-    
+
+        static void retain(ChessGameState* state);
+        static void release(ChessGameState* state);
+
+        // Frees every state that is neither retained nor a cached child of a retained state,
+        // once the number of states has doubled since the last collect (or always if is_forced),
+        // so positions stay interned across a few frames and the sweep is amortized.
+        // ChessHMM collects on every set_probs and bind: any ChessGameState* not reachable from
+        // the HMM (e.g. a get_parent() result or a create_state result kept by the caller) may be
+        // freed by them, retain it to keep it.
+        static void collect(bool is_forced = false);
+
+        static size_t size();
+        // blocks requested from the system by the state pool and the intern table so far
+        static size_t allocations();
+
     private:
+        // move already known to be legal (generated by the position itself), skips validation
+        static ChessGameState* create_child(ChessGameState* position, ChessMove move);
+
+        // returns the already interned equal position, or a pooled copy of position registered as new
+        static ChessGameState* intern(const ChessGameState& position);
+        static void insert_interned(ChessGameState* state);
+
         struct Registry {
+            Utils::Pool<ChessGameState> pool;
             std::vector<ChessGameState*> states;
+            // open addressing on the zobrist hash (linear probing, power of two size), null = empty
+            std::vector<ChessGameState*> interned;
+            size_t table_allocations;
+            uint32_t generation;
+            size_t collect_threshold; // states count that triggers the next collect
             ~Registry();
         };
 
@@ -3,71 +3,127 @@
 #include <stdexcept>
 #include <cmath>
 
-HMMState::HMMState(ChessGameState* position) : parent(nullptr) {
+HMMState::HMMState(ChessGameState* position) : parent(nullptr), children(nullptr), n_children(0), moved_to(nullptr) {
     HMMState::game_state = position;
 
     HMMState::timestep = 0;
     HMMState::prob = 0;
     HMMState::observartion_prob = 0;
+    HMMState::position_cost = 0;
 
     HMMState::is_children_computed = false;
 
     HMMState::is_self_loop = false;
+
+    GameStateFactory::retain(position);
 }
-HMMState::HMMState(HMMState& parent, ChessGameState* position, bool is_selfloop) : parent(&parent) {
+HMMState::HMMState(HMMState& parent, ChessGameState* position, ChessMove move, bool is_selfloop) : parent(&parent), move(move), children(nullptr), n_children(0), moved_to(nullptr) {
     HMMState::game_state = position;
 
     HMMState::timestep = parent.timestep+1;
     HMMState::prob = 0;
     HMMState::observartion_prob = 0;
+    HMMState::position_cost = 0;
 
     HMMState::is_children_computed = false;
 
     HMMState::is_self_loop = is_selfloop;
+
+    GameStateFactory::retain(position);
 }
+HMMState::HMMState(const HMMState& other) : parent(other.parent), move(other.move), children(nullptr), n_children(0), moved_to(nullptr) {
+    HMMState::game_state = other.game_state;
 
-double HMMState::eval_prob(Utils::Matrix<float>& obs_probs) {
-    if (obs_probs.shape.i != 8 || obs_probs.shape.j != 8 || obs_probs.shape.k != 13) throw invalid_argument("Matrix Shape is Invalid");
+    HMMState::timestep = other.timestep;
+    HMMState::prob = other.prob;
+    HMMState::observartion_prob = other.observartion_prob;
+    HMMState::position_cost = other.position_cost;
 
-    HMMState::observartion_prob = 0;
-    for (ssize_t i = 0; i < 8; i++)
+    HMMState::is_children_computed = false;
+
+    HMMState::is_self_loop = other.is_self_loop;
+
+    GameStateFactory::retain(HMMState::game_state);
+}
+HMMState::~HMMState() {
+    GameStateFactory::release(HMMState::game_state);
+}
+
+HMMObservation::HMMObservation(const vector<float>& obs_probs) {
+    if (obs_probs.size() != 64 * 13) throw invalid_argument("Matrix Shape is Invalid");
+
+    for (int sq = 0; sq < 64; sq++)
     {
-        for (ssize_t j = 0; j < 8; j++)
+        uint8_t obsereved_label = 0;
+        for (int k = 0; k < 13; k++)
+        {
+            HMMObservation::cost[sq][k] = obs_probs[sq * 13 + k];
+            if (HMMObservation::cost[sq][k] < HMMObservation::cost[sq][obsereved_label]) obsereved_label = (uint8_t)k;
+        }
+        for (int k = 0; k < 13; k++)
         {
-            HMMState::observartion_prob += obs_probs[{i,j,(ssize_t)(HMMState::game_state->current_position[i][j])}];
+            HMMObservation::square_cost[sq][k] = (double)HMMObservation::cost[sq][k] * (k == obsereved_label ? 1 : 2);
         }
     }
+}
+
+double HMMObservation::position_cost(const ChessGameState* position) const {
+    double res = 0;
+    for (int sq = 0; sq < 64; sq++) {
+        res += HMMObservation::square_cost[sq][position->current_position[sq / 8][sq % 8]];
+    }
+    return res;
+}
 
-    // HMMState::observartion_prob = 0;
-    for (ssize_t i = 0; i < 8; i++)
+// Every square costs its label's cost, once more if the square changed with the move or differs
+// from the observed label. Squares the move doesn't touch cost the same as in the parent's position,
+// so only the 2-4 changed squares are evaluated on top of the parent's position_cost.
+double HMMObservation::move_cost(double position_cost, const ChessGameState* position, ChessMove move) const {
+    if (move.is_null()) return position_cost;
+
+    int from = move.from();
+    int to = move.to();
+    uint8_t piece = position->current_position[from / 8][from % 8];
+    uint8_t color = (piece < 6) ? 0 : 6;
+
+    // changed squares with their new labels
+    int changed[4] = {from, to, -1, -1};
+    uint8_t labels[4] = {12, piece, 12, 12};
+    switch (move.flags())
     {
-        for (ssize_t j = 0; j < 8; j++)
-        {
-            uint8_t obsereved_label = 0;
-            for (ssize_t k = 0; k < 13; k++)
-            {
-                if (obs_probs[{i,j,k}] < obs_probs[{i,j,obsereved_label}]) obsereved_label = (uint8_t)k;
-            }
+    case MoveFlags::PROMOTION_MOVE:
+        labels[1] = move.promotion() + color;
+        break;
+    case MoveFlags::EN_PASSANT_MOVE:
+        changed[2] = (from & ~7) | (to & 7); // captured pawn
+        break;
+    case MoveFlags::CASTLING_MOVE:
+        changed[2] = (from & ~7) | (to > from ? 7 : 0); // rook from
+        changed[3] = (from + to) / 2;                   // rook to
+        labels[3] = PieceTypes::ROOK + color;
+        break;
+    default:
+        break;
+    }
 
-            if (
-                HMMState::game_state->current_position[i][j] != HMMState::parent->game_state->current_position[i][j] || // move
-                HMMState::game_state->current_position[i][j] != obsereved_label // difference to observed
-            )
-                HMMState::observartion_prob += obs_probs[{i,j,(ssize_t)(HMMState::game_state->current_position[i][j])}]; // expected
-        }
+    double res = position_cost;
+    for (int i = 0; i < 4; i++) {
+        int sq = changed[i];
+        if (sq < 0) continue;
+        uint8_t old_label = position->current_position[sq / 8][sq % 8];
+        res += 2.0 * HMMObservation::cost[sq][labels[i]] - HMMObservation::square_cost[sq][old_label];
     }
+    return res;
+}
+
+double HMMState::eval_prob(const HMMObservation& obs) {
+    HMMState::observartion_prob = obs.move_cost(HMMState::parent->position_cost, HMMState::parent->game_state, HMMState::move);
 
     HMMState::prob = HMMState::observartion_prob + HMMState::transition_prob() + HMMState::parent_prob();
 
     return HMMState::prob;
 }
 
-vector<HMMState*> HMMState::get_children() {
-    if (!HMMState::is_children_computed) HMMState::compute_children();
-
-    return HMMState::children;
-}
-
 bool HMMState::operator<(const HMMState& other) const {
     return HMMState::prob < other.prob;
 }
@@ -89,128 +145,489 @@ double HMMState::parent_prob() {
 double HMMState::get_child_transition_prob(bool is_legal) const {
     if (!HMMState::is_children_computed) throw logic_error("Children Not Computed");
 
-    return log(HMMState::children.size());
+    return log(HMMState::n_children);
 }
 
-void HMMState::compute_children() {
-    HMMState::children.push_back(HMMStateFactory::create_state(this, HMMState::game_state, true)); // self loop
+void HMMState::compute_children(HMMStateFactory& factory) {
+    HMMState::game_state->eval_next();
+    factory.reserve_candidates(HMMState::game_state->children.size() + 1);
 
-    for (ChessGameState* positions : HMMState::game_state->get_children()) {
-        HMMState::children.push_back(HMMStateFactory::create_state(this, positions)); // follow up legal moves
+    HMMState::children = factory.create_candidate(this, HMMState::game_state, ChessMove(), true); // self loop
+    for (const auto& [move, position] : HMMState::game_state->children) {
+        factory.create_candidate(this, position, move); // follow up legal moves
     }
+    HMMState::n_children = HMMState::game_state->children.size() + 1;
     HMMState::is_children_computed = true;
 }
 
+// forgets the candidates, they are recomputed if this state is expanded again
+void HMMState::drop_children() {
+    HMMState::children = nullptr;
+    HMMState::n_children = 0;
+    HMMState::is_children_computed = false;
+}
+
 // --------------------------------------------------
 
-HMMStateFactory::Registry HMMStateFactory::registry = {
-    vector<HMMState*>(0)
-};
-HMMState* HMMStateFactory::create_state(HMMState* parent, ChessGameState* position, bool is_selfloop) {
-    HMMState* new_state;
-    if (parent == nullptr) new_state = new HMMState(position);
-    else new_state = new HMMState(*parent, position, is_selfloop);
+HMMStateFactory::HMMStateFactory(size_t layer_width) : candidates(4096), bound(1) {
+    HMMStateFactory::layer_width = layer_width;
+    HMMStateFactory::first_layer = 0;
+    HMMStateFactory::layer_allocations = 0;
+}
+HMMStateFactory::~HMMStateFactory() {
+    HMMStateFactory::clear();
+    for (auto arena : HMMStateFactory::spare_layers) {
+        delete arena;
+    }
+}
+
+HMMState* HMMStateFactory::create_root(ChessGameState* position) {
+    return HMMStateFactory::bound.create(position);
+}
+
+void HMMStateFactory::reserve_candidates(size_t n) {
+    HMMStateFactory::candidates.reserve(n);
+}
+HMMState* HMMStateFactory::create_candidate(HMMState* parent, ChessGameState* position, ChessMove move, bool is_selfloop) {
+    return HMMStateFactory::candidates.create(*parent, position, move, is_selfloop);
+}
+void HMMStateFactory::clear_candidates() {
+    HMMStateFactory::candidates.clear();
+}
+
+Utils::Arena<HMMState>* HMMStateFactory::layer(int timestep) {
+    int index = timestep - HMMStateFactory::first_layer;
+    while ((int)HMMStateFactory::layers.size() <= index) HMMStateFactory::layers.push_back(nullptr);
+
+    Utils::Arena<HMMState>*& layer = HMMStateFactory::layers[index];
+    if (layer == nullptr) {
+        if (HMMStateFactory::spare_layers.empty()) {
+            layer = new Utils::Arena<HMMState>(HMMStateFactory::layer_width);
+            HMMStateFactory::layer_allocations++;
+        } else {
+            layer = HMMStateFactory::spare_layers.back();
+            HMMStateFactory::spare_layers.pop_back();
+        }
+    }
+    return layer;
+}
+
+HMMState* HMMStateFactory::keep(const HMMState& state) {
+    return HMMStateFactory::layer(state.timestep)->create(state);
+}
+
+HMMState* HMMStateFactory::create_state(HMMState* parent, ChessGameState* position, ChessMove move, bool is_selfloop) {
+    return HMMStateFactory::layer(parent->timestep + 1)->create(*parent, position, move, is_selfloop);
+}
+
+HMMState* HMMStateFactory::bind(const HMMState& state) {
+    HMMStateFactory::bound.clear();
 
-    HMMStateFactory::registry.states.push_back(new_state);
-    return new_state;
+    HMMState* bound_state = HMMStateFactory::bound.create(state);
+    bound_state->parent = nullptr;
+    return bound_state;
 }
 
-HMMStateFactory::Registry::~Registry() {
-    for (auto ptr : HMMStateFactory::registry.states) {
-        try {
-            delete ptr;
-        } catch (...) {}
+void HMMStateFactory::compact_layers(int first_timestep, const vector<vector<HMMState*>*>& timed_states) {
+    // survivors go to fresh arenas, the old ones (with the pruned states) are dropped as a whole
+    // once the next layer has read its parents' moved_to
+    vector<Utils::Arena<HMMState>*> old_layers;
+    for (size_t i = 0; i < timed_states.size(); i++) {
+        int index = first_timestep + (int)i - HMMStateFactory::first_layer;
+        if (index < 0 || index >= (int)HMMStateFactory::layers.size() || HMMStateFactory::layers[index] == nullptr) continue;
+
+        old_layers.push_back(HMMStateFactory::layers[index]);
+        HMMStateFactory::layers[index] = nullptr;
+        Utils::Arena<HMMState>* new_layer = HMMStateFactory::layer(first_timestep + (int)i);
+
+        vector<HMMState*>& states = *(timed_states[i]);
+        size_t kept = 0;
+        for (HMMState* state : states) {
+            if (state->parent->moved_to == nullptr) {
+                state->moved_to = nullptr;
+                continue;
+            }
+            HMMState* moved = new_layer->create(*state);
+            moved->parent = state->parent->moved_to;
+            state->moved_to = moved;
+            states[kept++] = moved;
+        }
+        states.resize(kept);
+    }
+
+    for (auto layer : old_layers) {
+        HMMStateFactory::recycle(layer);
+    }
+}
+
+void HMMStateFactory::drop_layer(int timestep) {
+    int index = timestep - HMMStateFactory::first_layer;
+    if (index < 0 || index >= (int)HMMStateFactory::layers.size() || HMMStateFactory::layers[index] == nullptr) return;
+
+    HMMStateFactory::recycle(HMMStateFactory::layers[index]);
+    HMMStateFactory::layers[index] = nullptr;
+}
+
+void HMMStateFactory::drop_layers_until(int timestep) {
+    while (HMMStateFactory::first_layer <= timestep) {
+        if (!HMMStateFactory::layers.empty()) {
+            HMMStateFactory::drop_layer(HMMStateFactory::first_layer);
+            HMMStateFactory::layers.pop_front();
+        }
+        HMMStateFactory::first_layer++;
+    }
+}
+
+void HMMStateFactory::recycle(Utils::Arena<HMMState>* layer) {
+    if (HMMStateFactory::spare_layers.size() < HMMStateFactory::MAX_SPARE_LAYERS) {
+        layer->clear();
+        HMMStateFactory::spare_layers.push_back(layer);
+    } else {
+        delete layer;
     }
 }
 
+void HMMStateFactory::clear() {
+    HMMStateFactory::candidates.clear();
+    for (auto layer : HMMStateFactory::layers) {
+        if (layer != nullptr) HMMStateFactory::recycle(layer);
+    }
+    HMMStateFactory::layers.clear();
+    HMMStateFactory::first_layer = 0;
+    HMMStateFactory::bound.clear();
+}
+
+size_t HMMStateFactory::size() const {
+    size_t res = HMMStateFactory::candidates.size() + HMMStateFactory::bound.size();
+    for (auto layer : HMMStateFactory::layers) {
+        if (layer != nullptr) res += layer->size();
+    }
+    return res;
+}
+
+size_t HMMStateFactory::allocations() const {
+    size_t res = HMMStateFactory::layer_allocations + HMMStateFactory::candidates.allocations() + HMMStateFactory::bound.allocations();
+    for (auto layer : HMMStateFactory::layers) {
+        if (layer != nullptr) res += layer->allocations();
+    }
+    for (auto layer : HMMStateFactory::spare_layers) {
+        res += layer->allocations();
+    }
+    return res;
+}
+
 // --------------------------------------------------
 
-bool ChessHMM::CompareProbs::operator()(const HMMState* a, const HMMState* b) const {
-    return a->prob < b->prob;  // smaller cost = higher priority
+bool ChessHMM::Candidate::operator<(const ChessHMM::Candidate& other) const {
+    if (ChessHMM::Candidate::prob != other.prob) return ChessHMM::Candidate::prob < other.prob;  // smaller cost = higher priority
+    return ChessHMM::Candidate::order < other.order;
 }
 
-ChessHMM::ChessHMM(int max_width, string fen) {
+ChessHMM::ChessHMM(int max_width, string fen, int n_threads, bool lazy_expansion) : factory((size_t)max_width) {
+    ChessHMM::workers = new Utils::WorkerPool(n_threads);
+    ChessHMM::lazy_expansion = lazy_expansion;
+
     ChessHMM::max_width = (size_t)max_width;
+    ChessHMM::min_width = (size_t)max_width;
+    ChessHMM::width_gap = 0;
+    ChessHMM::timed_widths = deque<size_t>(1, ChessHMM::max_width);
     ChessHMM::_top_bind_t = 0;
-    ChessHMM::root = HMMStateFactory::create_state(nullptr, GameStateFactory::create_state(fen));
+    HMMState* root = ChessHMM::factory.create_root(GameStateFactory::create_state(fen));
+    ChessHMM::append_bound(root->game_state);
 
-    ChessHMM::timed_tree_states = vector<multiset<HMMState*, ChessHMM::CompareProbs>*>(0);
-    ChessHMM::timed_tree_states.push_back(new multiset<HMMState*, ChessHMM::CompareProbs>());
-    ChessHMM::timed_tree_states[0]->insert(root);
+    ChessHMM::timed_tree_states.push_back(new vector<HMMState*>());
+    ChessHMM::timed_tree_states[0]->push_back(root);
 }
 ChessHMM::~ChessHMM() {
     for (auto vec_ptr : ChessHMM::timed_tree_states) {
         delete vec_ptr;
     }
+    ChessHMM::factory.clear();
+    GameStateFactory::collect(true);
+
+    delete ChessHMM::workers;
 }
 
 int ChessHMM::top_t() {
-    return ChessHMM::timed_tree_states.size() - 1;
+    return ChessHMM::_top_bind_t + (int)ChessHMM::timed_tree_states.size() - 1;
 }
 int ChessHMM::top_bind_t() {
     return ChessHMM::_top_bind_t;
 }
 
+vector<HMMState*>& ChessHMM::layer_states(int timestep) {
+    return *(ChessHMM::timed_tree_states[timestep - ChessHMM::_top_bind_t]);
+}
+
+void ChessHMM::append_bound(const ChessGameState* position) {
+    auto& pos = position->current_position;
+    for (int i = 0; i < 8; i++) {
+        ChessHMM::bound_history.insert(ChessHMM::bound_history.end(), pos[i], pos[i] + 8);
+    }
+}
+
 void ChessHMM::set_probs(int timestep, const vector<float>& obs_probs) {
-    Utils::Matrix<float> obs_probs_mat(obs_probs, {8,8,13});
+    HMMObservation obs(obs_probs);
 
-    if ((timestep != ChessHMM::top_t() && timestep != ChessHMM::top_t()+1) || timestep <= 0) throw invalid_argument("Timstep Invalid");
+    if ((timestep != ChessHMM::top_t() && timestep != ChessHMM::top_t()+1) || timestep <= ChessHMM::top_bind_t()) throw invalid_argument("Timstep Invalid");
 
     if (timestep == ChessHMM::top_t()) {
         // clear next queue elements
-        ChessHMM::timed_tree_states[timestep]->clear();
+        ChessHMM::layer_states(timestep).clear();
+        ChessHMM::factory.drop_layer(timestep);
+        ChessHMM::timed_widths.back() = ChessHMM::next_width(timestep - 1);
     } else if (timestep == ChessHMM::top_t()+1) {
-        ChessHMM::timed_tree_states.push_back(new multiset<HMMState*, ChessHMM::CompareProbs>());
+        ChessHMM::timed_tree_states.push_back(new vector<HMMState*>());
+        ChessHMM::timed_widths.push_back(ChessHMM::next_width(timestep - 1));
+    }
+
+    if (ChessHMM::lazy_expansion) ChessHMM::expand_lazy(timestep, obs);
+    else ChessHMM::expand_eager(timestep, obs);
+
+    GameStateFactory::collect();
+}
+
+void ChessHMM::set_adaptive_width(int min_width, double width_gap) {
+    ChessHMM::min_width = (size_t)max(1, min(min_width, (int)ChessHMM::max_width));
+    ChessHMM::width_gap = width_gap;
+}
+
+int ChessHMM::get_width(int timestep) {
+    if (timestep < ChessHMM::top_bind_t() || timestep > ChessHMM::top_t()) throw invalid_argument("Timstep Invalid");
+    return (int)ChessHMM::timed_widths[timestep - ChessHMM::_top_bind_t];
+}
+
+// Width of the layer after timestep, from the cost gap between its best and k-th hypotheses
+size_t ChessHMM::next_width(int timestep) {
+    size_t width = ChessHMM::timed_widths[timestep - ChessHMM::_top_bind_t];
+    if (ChessHMM::max_width == 0 || ChessHMM::min_width >= ChessHMM::max_width) return width;
+
+    vector<HMMState*>& layer = ChessHMM::layer_states(timestep);
+    if (layer.size() < width) return width; // beam not full, nothing to compare against
+
+    double best = layer[0]->prob;
+    if (layer[width - 1]->prob - best < ChessHMM::width_gap) {
+        return min(ChessHMM::max_width, width + width / 2 + 1);
+    }
+    if (layer[width / 2]->prob - best > ChessHMM::width_gap) {
+        return max(ChessHMM::min_width, width * 3 / 4);
+    }
+    return width;
+}
+
+// Creates every child of the previous layer, scores them, keeps the best of the layer's width
+void ChessHMM::expand_eager(int timestep, const HMMObservation& obs) {
+    vector<HMMState*>& parents = ChessHMM::layer_states(timestep - 1);
+
+    // positions: move generation on the workers, interning in parent order
+    ChessHMM::expansions.resize(max(ChessHMM::expansions.size(), parents.size()));
+    ChessHMM::workers->parallel_for(parents.size(), [&](size_t i) {
+        if (!parents[i]->game_state->is_expanded()) parents[i]->game_state->generate_children(ChessHMM::expansions[i]);
+    });
+    for (size_t i = 0; i < parents.size(); i++) {
+        if (!parents[i]->game_state->is_expanded()) parents[i]->game_state->set_children(ChessHMM::expansions[i]);
     }
 
-    for (HMMState* state : *(ChessHMM::timed_tree_states[timestep-1])) {
-        for (HMMState* child_state : state->get_children()) {            
-            child_state->eval_prob(obs_probs_mat);
-            ChessHMM::timed_tree_states[timestep]->insert(child_state);
+    // candidates: placed in the arena in parent order
+    ChessHMM::candidate_offsets.resize(parents.size());
+    size_t n_candidates = 0;
+    for (size_t i = 0; i < parents.size(); i++) {
+        parents[i]->compute_children(ChessHMM::factory);
+        ChessHMM::candidate_offsets[i] = n_candidates;
+        n_candidates += parents[i]->n_children;
+    }
+
+    // scoring on the workers, each parent writes its own slice so the order doesn't depend on scheduling
+    ChessHMM::candidates.resize(n_candidates);
+    ChessHMM::workers->parallel_for(parents.size(), [&](size_t i) {
+        HMMState* state = parents[i];
+        state->position_cost = obs.position_cost(state->game_state);
+        for (uint16_t j = 0; j < state->n_children; j++) {
+            HMMState* child_state = &(state->children[j]);
+            child_state->eval_prob(obs);
+            uint32_t order = (uint32_t)(ChessHMM::candidate_offsets[i] + j);
+            ChessHMM::candidates[order] = {child_state->prob, order, child_state, 0.0, 0, 0};
         }
+    });
+
+    ChessHMM::merge_candidates();
+
+    // partial selection of the best width, only those get sorted
+    size_t width = ChessHMM::timed_widths[timestep - ChessHMM::_top_bind_t];
+    auto last = ChessHMM::candidates.end();
+    if (width > 0 && ChessHMM::candidates.size() > width) {
+        last = ChessHMM::candidates.begin() + width;
+        nth_element(ChessHMM::candidates.begin(), last - 1, ChessHMM::candidates.end());
     }
+    sort(ChessHMM::candidates.begin(), last);
 
-    if (ChessHMM::timed_tree_states[timestep]->size() > ChessHMM::max_width) {   
-        auto it = ChessHMM::timed_tree_states[timestep]->begin();
-        advance(it, ChessHMM::max_width);
-        ChessHMM::timed_tree_states[timestep]->erase(it, ChessHMM::timed_tree_states[timestep]->end());
+    // survivors are copied into the layer storage
+    vector<HMMState*>& layer = ChessHMM::layer_states(timestep);
+    layer.clear();
+    for (auto it = ChessHMM::candidates.begin(); it != last; ++it) {
+        layer.push_back(ChessHMM::factory.keep(*(it->state)));
     }
+
+    // recycle the candidates, then free the positions only they used
+    for (HMMState* state : parents) {
+        state->drop_children();
+    }
+    ChessHMM::factory.clear_candidates();
 }
-void ChessHMM::bind(int timestep) {
-    if (timestep > ChessHMM::top_t() || timestep <= ChessHMM::top_bind_t()) throw invalid_argument("Timstep Invalid");
-    HMMState* state = *(ChessHMM::timed_tree_states[ChessHMM::top_t()]->begin());
-    for (; state != nullptr; state = state->parent) {
-        if (state->timestep <= timestep) {
-            ChessHMM::timed_tree_states[state->timestep]->clear();
-            ChessHMM::timed_tree_states[state->timestep]->insert(state);
+
+// Scores every move straight from the parent position (exact, a few squares per move), then
+// walks them best first and creates positions and states only for those entering the layer.
+// Same layer as expand_eager: walking in (prob, order) order and skipping positions already
+// taken keeps the cheapest path into each position, as merge_candidates does.
+void ChessHMM::expand_lazy(int timestep, const HMMObservation& obs) {
+    vector<HMMState*>& parents = ChessHMM::layer_states(timestep - 1);
+
+    // legal moves on the workers (positions in a layer are distinct after merging, so no two tasks share one)
+    ChessHMM::workers->parallel_for(parents.size(), [&](size_t i) {
+        parents[i]->game_state->eval_moves();
+    });
+
+    ChessHMM::candidate_offsets.resize(parents.size());
+    size_t n_candidates = 0;
+    for (size_t i = 0; i < parents.size(); i++) {
+        ChessHMM::candidate_offsets[i] = n_candidates;
+        n_candidates += parents[i]->game_state->children.size() + 1;
+    }
+
+    // scoring, same arithmetic as HMMState::eval_prob so both modes rank identically
+    ChessHMM::candidates.resize(n_candidates);
+    ChessHMM::workers->parallel_for(parents.size(), [&](size_t i) {
+        HMMState* state = parents[i];
+        ChessGameState* position = state->game_state;
+        state->position_cost = obs.position_cost(position);
+
+        size_t n_children = position->children.size() + 1;
+        double child_transition_prob = log(n_children);
+        for (size_t j = 0; j < n_children; j++) {
+            ChessMove move = (j == 0) ? ChessMove() : position->children[j - 1].first;
+            double observartion_prob = obs.move_cost(state->position_cost, position, move);
+            double transition_prob = child_transition_prob;
+            if (j != 0) transition_prob += 20;
+
+            uint32_t order = (uint32_t)(ChessHMM::candidate_offsets[i] + j);
+            ChessHMM::candidates[order] = {observartion_prob + transition_prob + state->prob, order, nullptr, observartion_prob, (uint32_t)i, (uint16_t)j};
+        }
+    });
+
+    vector<HMMState*>& layer = ChessHMM::layer_states(timestep);
+    layer.clear();
+
+    size_t width = ChessHMM::timed_widths[timestep - ChessHMM::_top_bind_t];
+    if (width == 0) width = n_candidates;
+
+    size_t table_size = 64;
+    while (table_size < width * 2) table_size *= 2;
+    ChessHMM::merge_table.assign(table_size, -1);
+    size_t mask = table_size - 1;
+
+    // best first, sorting a window of twice the width at a time
+    auto begin = ChessHMM::candidates.begin();
+    while (begin != ChessHMM::candidates.end() && layer.size() < width) {
+        auto end = ChessHMM::candidates.end();
+        if ((size_t)(end - begin) > width * 2) {
+            end = begin + width * 2;
+            nth_element(begin, end - 1, ChessHMM::candidates.end());
+        }
+        sort(begin, end);
+
+        for (auto it = begin; it != end && layer.size() < width; ++it) {
+            HMMState* parent = parents[it->parent];
+            ChessGameState* position = (it->move_index == 0) ? parent->game_state : parent->game_state->get_child(it->move_index - 1);
+
+            size_t slot = position->get_hash() & mask;
+            while (ChessHMM::merge_table[slot] >= 0 && layer[ChessHMM::merge_table[slot]]->game_state != position) {
+                slot = (slot + 1) & mask;
+            }
+            if (ChessHMM::merge_table[slot] >= 0) continue; // reached through a cheaper path already
+
+            ChessMove move = (it->move_index == 0) ? ChessMove() : parent->game_state->children[it->move_index - 1].first;
+            HMMState* state = ChessHMM::factory.create_state(parent, position, move, it->move_index == 0);
+            state->observartion_prob = it->observartion_prob;
+            state->prob = it->prob;
+
+            ChessHMM::merge_table[slot] = (int32_t)layer.size();
+            layer.push_back(state);
         }
+        begin = end;
     }
+}
 
-    for (int t = timestep+1; t <= ChessHMM::top_t(); ++t) {
-        // collect pointers to valid parents
-        std::unordered_set<HMMState*> valid_parents;
-        for (auto s : *(ChessHMM::timed_tree_states[t - 1]))
-            valid_parents.insert(s);
+// Viterbi merge: candidates reaching the same position (interned, so the same pointer) are one
+// hypothesis, only the cheapest path into it is kept. Order of the kept candidates is preserved.
+void ChessHMM::merge_candidates() {
+    size_t table_size = 64;
+    while (table_size < ChessHMM::candidates.size() * 2) table_size *= 2;
+    ChessHMM::merge_table.assign(table_size, -1);
+    size_t mask = table_size - 1;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < ChessHMM::candidates.size(); i++) {
+        const Candidate& candidate = ChessHMM::candidates[i];
+        ChessGameState* position = candidate.state->game_state;
+
+        size_t slot = position->get_hash() & mask;
+        while (ChessHMM::merge_table[slot] >= 0 && ChessHMM::candidates[ChessHMM::merge_table[slot]].state->game_state != position) {
+            slot = (slot + 1) & mask;
+        }
 
-        // filter current level
-        std::multiset<HMMState*, ChessHMM::CompareProbs> pruned_level;
-        for (auto s : *(ChessHMM::timed_tree_states[t])) {
-            if (valid_parents.count(s->parent))
-                pruned_level.insert(s);
+        if (ChessHMM::merge_table[slot] < 0) {
+            ChessHMM::merge_table[slot] = kept;
+            ChessHMM::candidates[kept++] = candidate;
+        } else if (candidate < ChessHMM::candidates[ChessHMM::merge_table[slot]]) {
+            ChessHMM::candidates[ChessHMM::merge_table[slot]] = candidate;
         }
+    }
+    ChessHMM::candidates.resize(kept);
+}
+
+void ChessHMM::bind(int timestep) {
+    if (timestep > ChessHMM::top_t() || timestep <= ChessHMM::top_bind_t()) throw invalid_argument("Timstep Invalid");
 
-        // replace with pruned version
-        ChessHMM::timed_tree_states[t]->swap(pruned_level);
+    // newly bound part of the best path, oldest last
+    vector<HMMState*> path;
+    HMMState* state = ChessHMM::timed_tree_states.back()->front();
+    for (; state->timestep > ChessHMM::top_bind_t(); state = state->parent) {
+        if (state->timestep <= timestep) path.push_back(state);
+    }
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        ChessHMM::append_bound((*it)->game_state);
     }
 
+    // only the bound state survives at timestep, it replaces the previous one
+    for (auto s : ChessHMM::layer_states(timestep)) {
+        s->moved_to = nullptr;
+    }
+    HMMState* bound_state = ChessHMM::factory.bind(*path.front());
+    path.front()->moved_to = bound_state;
+
+    // one pass per later layer: states whose parent was pruned go too, the rest is compacted in order
+    int offset = timestep - ChessHMM::_top_bind_t;
+    vector<vector<HMMState*>*> live_layers(ChessHMM::timed_tree_states.begin() + offset + 1, ChessHMM::timed_tree_states.end());
+    ChessHMM::factory.compact_layers(timestep + 1, live_layers);
+
+    // the bound prefix only lives on in bound_history
+    ChessHMM::factory.drop_layers_until(timestep);
+    for (int i = 0; i < offset; i++) {
+        delete ChessHMM::timed_tree_states.front();
+        ChessHMM::timed_tree_states.pop_front();
+        ChessHMM::timed_widths.pop_front();
+    }
+    ChessHMM::timed_tree_states.front()->assign(1, bound_state);
     ChessHMM::_top_bind_t = timestep;
+
+    GameStateFactory::collect();
 }
 string ChessHMM::print(int timestep) {
-    if (timestep > ChessHMM::top_t() || timestep < 0) throw invalid_argument("Timstep Invalid");
+    if (timestep > ChessHMM::top_t() || timestep < ChessHMM::top_bind_t()) throw invalid_argument("Timstep Invalid");
 
     string res = "";
 
-    for (HMMState* s : *(ChessHMM::timed_tree_states[timestep])) {
+    for (HMMState* s : ChessHMM::layer_states(timestep)) {
         res += "Prob: " + to_string(s->prob) + "\n\n";
         res += s->game_state->str();
         res += "\n\n\n\n";
@@ -218,25 +635,31 @@ string ChessHMM::print(int timestep) {
 
     return res;
 }
-Utils::Matrix<int> ChessHMM::get_history(bool include_non_bound) {
-    ssize_t N = (include_non_bound ? ChessHMM::top_t()+1 : ChessHMM::top_bind_t()+1);
-    // auto res = vector<int>(N * 8 *8);
-    Utils::Matrix<int> res({N, 8, 8});
-
-    HMMState* state = *(ChessHMM::timed_tree_states[ChessHMM::top_t()])->begin();
+Utils::Matrix<int> ChessHMM::get_history(bool include_non_bound, int from_timestep) {
+    int top = (include_non_bound ? ChessHMM::top_t() : ChessHMM::top_bind_t());
+    from_timestep = max(0, min(from_timestep, top + 1));
+    Utils::Matrix<int> res({(ssize_t)(top + 1 - from_timestep), 8, 8});
+
+    // bound prefix straight from the flat history
+    int bound_top = min(top, ChessHMM::top_bind_t());
+    for (int t = from_timestep; t <= bound_top; t++) {
+        const uint8_t* pos = &(ChessHMM::bound_history[(size_t)t * 64]);
+        for (int i = 0; i < 64; i++) {
+            res[{t - from_timestep, i / 8, i % 8}] = static_cast<int>(pos[i]);
+        }
+    }
 
-    for (; state != nullptr; state = state->parent) {
-        if ((!include_non_bound) && state->timestep > ChessHMM::top_bind_t()) continue;
+    // unbound suffix along the best path
+    if (!include_non_bound) return res;
 
+    HMMState* state = ChessHMM::timed_tree_states.back()->front();
+    for (; state->timestep > ChessHMM::top_bind_t() && state->timestep >= from_timestep; state = state->parent) {
         auto& pos = state->game_state->current_position;
         for (int i = 0; i < 8; i++)
         {
             for (int j = 0; j < 8; j++)
             {
-                uint8_t value = pos[i][j];
-                // ssize_t flat_index = (state->timestep * 8 * 8) + (i * 8) + j;
-                // res[flat_index] = static_cast<int>(value);
-                res[{state->timestep, i, j}] = static_cast<int>(value);
+                res[{state->timestep - from_timestep, i, j}] = static_cast<int>(pos[i][j]);
             }
         }
     }
@@ -1,24 +1,48 @@
 #include "ChessGameState.h"
 #include <vector>
+#include <deque>
 #include <queue>
-#include <unordered_set>
-#include <set>
+#include <algorithm>
 #include "Utils/Utils.h"
+#include "Utils/Arena.h"
+#include "Utils/WorkerPool.h"
 
 using namespace std;
 
 #ifndef CHESSHMM
 #define CHESSHMM
 
+class HMMStateFactory;
+
+/**
+ * Per frame observation costs, precomputed once per set_probs
+ * Squares are indexed rank * 8 + file, labels as in ChessGameState::current_position.
+ */
+struct HMMObservation {
+    HMMObservation(const vector<float>& obs_probs);
+
+    float cost[64][13];          // obs_probs[rank][file][label]
+    double square_cost[64][13];  // cost of a square keeping its label: cost, counted twice when it differs from the observed (min cost) label
+
+    // observation cost of a state whose position is unchanged from its parent's (self loop)
+    double position_cost(const ChessGameState* position) const;
+    // observation cost of the state reached by move from position, given position_cost(position)
+    double move_cost(double position_cost, const ChessGameState* position, ChessMove move) const;
+};
+
 class HMMState {
     friend class ChessHMM;
+    friend class HMMStateFactory;
 
     public:
         HMMState(ChessGameState* position);
-        HMMState(HMMState& parent, ChessGameState* position, bool is_selfloop = false);
-        double eval_prob(Utils::Matrix<float>& obs_probs);
-
-        vector<HMMState*> get_children();
+        HMMState(HMMState& parent, ChessGameState* position, ChessMove move, bool is_selfloop = false);
+        // copies start unexpanded
+        HMMState(const HMMState& other);
+        HMMState& operator=(const HMMState& other) = delete;
+        ~HMMState();
+        // parent's position_cost must be set for this observation
+        double eval_prob(const HMMObservation& obs);
 
         bool operator<(const HMMState& other) const;
         bool operator==(const HMMState& other) const;
@@ -26,7 +50,13 @@ class HMMState {
     private:
         ChessGameState* game_state;
         HMMState* parent;
-        vector<HMMState*> children;
+        ChessMove move; // from the parent's position, null for self loops and the root
+
+        // contiguous in the factory's candidate arena, valid until the candidates are cleared
+        HMMState* children;
+        uint16_t n_children;
+
+        HMMState* moved_to; // set while binding: this state's copy in the compacted layer, null if pruned
         
         int timestep;
         double prob;
@@ -34,6 +64,7 @@ class HMMState {
         bool is_self_loop;
 
         double observartion_prob;
+        double position_cost; // HMMObservation::position_cost of game_state, set before expanding
         double transition_prob();
         double parent_prob();
 
@@ -41,48 +72,132 @@ class HMMState {
 
         bool is_children_computed;
 
-        void compute_children();
+        void compute_children(HMMStateFactory& factory);
+        void drop_children();
 };
 
+/**
+ * Owns every HMMState of one ChessHMM
+ *
+ * Children are created as candidates in a scratch arena recycled on every expansion,
+ * the ones that make it into a layer are copied to that timestep's arena, and the latest
+ * bound state is moved to its own arena so whole layers can be dropped at once.
+ */
 class HMMStateFactory {
     public:
-        static HMMState* create_state(HMMState* parent, ChessGameState* position, bool is_selfloop = false);
+        static const size_t MAX_SPARE_LAYERS = 8; // dropped layers kept for reuse, the rest is freed
+
+        HMMStateFactory(size_t layer_width);
+        ~HMMStateFactory();
+
+        HMMState* create_root(ChessGameState* position);
+
+        // guarantees the next n candidates are contiguous
+        void reserve_candidates(size_t n);
+        HMMState* create_candidate(HMMState* parent, ChessGameState* position, ChessMove move, bool is_selfloop = false);
+        void clear_candidates();
+
+        // copy of state stored with its timestep's layer
+        HMMState* keep(const HMMState& state);
+        // new state stored directly with its timestep's layer
+        HMMState* create_state(HMMState* parent, ChessGameState* position, ChessMove move, bool is_selfloop = false);
+        // copy of state as the new bound state (no parent), replacing the previous one
+        HMMState* bind(const HMMState& state);
+        // rebuilds the layers from first_timestep on (timed_states[0] is first_timestep's) with the states
+        // whose parent survived (parent->moved_to, set by the caller for the layer before), keeping their order
+        void compact_layers(int first_timestep, const vector<vector<HMMState*>*>& timed_states);
+        void drop_layer(int timestep);
+        // drops every layer up to timestep, for good
+        void drop_layers_until(int timestep);
+
+        void clear();
+
+        size_t size() const;
+        // blocks requested from the system so far
+        size_t allocations() const;
 
     private:
-        struct Registry {
-            std::vector<HMMState*> states;
-            ~Registry();
-        };
+        Utils::Arena<HMMState>* layer(int timestep);
+        void recycle(Utils::Arena<HMMState>* layer);
 
-        static HMMStateFactory::Registry registry;
+        size_t layer_width;
+        size_t layer_allocations;
+
+        Utils::Arena<HMMState> candidates;
+        Utils::Arena<HMMState> bound;                 // latest bound state
+        deque<Utils::Arena<HMMState>*> layers;        // [timestep - first_layer], null once dropped
+        int first_layer;
+        vector<Utils::Arena<HMMState>*> spare_layers; // cleared arenas ready for reuse
 };
 
 class ChessHMM {
     public:
-        ChessHMM(int max_width, string fen = STARTING_POSITION_FEN);
+        // n_threads > 1 expands and scores the beam on a worker pool, with results identical to the serial run.
+        // lazy_expansion only creates the children that make it into the beam (same results as eager expansion).
+        ChessHMM(int max_width, string fen = STARTING_POSITION_FEN, int n_threads = 1, bool lazy_expansion = true);
         ~ChessHMM();
 
         int top_t();
         int top_bind_t();
         
+        // set_probs and bind may free game states outside the beam, see GameStateFactory::collect
         void set_probs(int timestep, const vector<float>& obs_probs);
+
+        // adaptive beam: each layer's width is picked between min_width and max_width from the previous
+        // layer, growing while its k-th hypothesis is within width_gap of the best and shrinking once
+        // the better half of the beam is already further than that
+        void set_adaptive_width(int min_width, double width_gap);
+        // beam width used for timestep, from top_bind_t() on
+        int get_width(int timestep);
         void bind(int timestep);
 
         string print(int timestep);
 
-        Utils::Matrix<int> get_history(bool include_non_bound = false);
+        // boards from from_timestep on, one row per timestep
+        Utils::Matrix<int> get_history(bool include_non_bound = false, int from_timestep = 0);
         string get_pgn();
     private:
-        HMMState* root;
+        // ranking entry, ties keep expansion order
+        struct Candidate {
+            double prob;
+            uint32_t order;
+            HMMState* state;       // eager expansion
+
+            double observartion_prob; // lazy expansion: state not created yet
+            uint32_t parent;
+            uint16_t move_index;   // 0 = self loop, else 1 + index in the parent position's moves
 
-        struct CompareProbs {
-            bool operator()(const HMMState* a, const HMMState* b) const;
+            bool operator<(const Candidate& other) const;
         };
+        vector<Candidate> candidates; // reused every set_probs
+        vector<int32_t> merge_table;  // open addressing on the position hash, candidate index or -1
 
-        vector<multiset<HMMState*, ChessHMM::CompareProbs>*> timed_tree_states;
+        void merge_candidates();
+
+        bool lazy_expansion;
+        void expand_eager(int timestep, const HMMObservation& obs);
+        void expand_lazy(int timestep, const HMMObservation& obs);
+
+        Utils::WorkerPool* workers;
+        vector<vector<pair<ChessMove, ChessGameState>>> expansions; // [parent], positions generated by the workers
+        vector<size_t> candidate_offsets;                           // [parent], first candidate of each parent
+
+        // live layers from top_bind_t() (the bound state alone) to top_t(), each sorted by prob, best first
+        deque<vector<HMMState*>*> timed_tree_states;
+        vector<HMMState*>& layer_states(int timestep);
+
+        vector<uint8_t> bound_history; // labels of every bound timestep's board, 64 per timestep, append only
+        void append_bound(const ChessGameState* position);
+
+        HMMStateFactory factory;
 
         int _top_bind_t;
         size_t max_width;
+        size_t min_width;
+        double width_gap;
+        deque<size_t> timed_widths; // beam width of each live layer
+
+        size_t next_width(int timestep);
 };
 
 #endif
\ No newline at end of file
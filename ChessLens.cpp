@@ -2,6 +2,7 @@
 #include "Utils/ChessUtils.h"
 #include <iostream>
 #include <fstream>
+#include <filesystem>
 // #include <span>
 #include <algorithm>
 #include <cmath>
@@ -81,6 +82,7 @@ void AvgTimes::print() const {
     std::cout << "  Occlusion:          " << (occlusion / count) * 1000.0 << "\n";
     std::cout << "  Piece Recognition:  " << (piece_recognition / count) * 1000.0 << "\n";
     std::cout << "  HMM:                " << (hmm / count) * 1000.0 << "\n";
+    std::cout << "  HMM Width:          " << (hmm_width / count) << "\n";
 }
 
 void AvgTimes::reset() {
@@ -90,6 +92,7 @@ void AvgTimes::reset() {
     occlusion = 0.0;
     piece_recognition = 0.0;
     hmm = 0.0;
+    hmm_width = 0.0;
     count = 0;
 }
 
@@ -132,8 +135,12 @@ void ChessLensImage::load_image(const std::string& img_path) {
 }
 
 cv::Mat ChessLensImage::prep_img(const cv::Mat& img) {
+    // PI_FISH frames are undistorted straight to this size
+    if (img.size() == cv::Size(PREP_SIZE, PREP_SIZE))
+        return img;
+
     cv::Mat resized;
-    cv::resize(img, resized, cv::Size(640, 640));
+    cv::resize(img, resized, cv::Size(PREP_SIZE, PREP_SIZE));
     return resized;
 }
 
@@ -194,19 +201,7 @@ std::pair<std::vector<float>, std::string> ChessLensImage::recognize_pieces(bool
     
     auto start = std::chrono::high_resolution_clock::now();
 
-    PieceDetectorResult result = piece_detector_->process(img_, board_corners_);
-    
-    // Map output [13, 8, 8] to internal [8, 8, 13]
-    piece_matrix_.assign(8 * 8 * 13, 0.0f);
-    for (int ch = 0; ch < 13; ++ch) {
-        for (int r = 0; r < 8; ++r) {
-            for (int c = 0; c < 8; ++c) {
-                // CNN format: [channel][row][col]
-                // State format: [row][col][channel]
-                piece_matrix_[r * 8 * 13 + c * 13 + ch] = result.board[ch * 64 + r * 8 + c];
-            }
-        }
-    }
+    piece_matrix_ = detect_pieces(img_, board_corners_);
     
     fen_ = ChessUtils::tensor_to_fen_max(piece_matrix_);
     pieces_detected_ = true;
@@ -220,6 +215,24 @@ std::pair<std::vector<float>, std::string> ChessLensImage::recognize_pieces(bool
     return {piece_matrix_, fen_};
 }
 
+std::vector<float> ChessLensImage::detect_pieces(const cv::Mat& img, const cv::Mat& board_corners) {
+    PieceDetectorResult result = piece_detector_->process(img, board_corners);
+    
+    // Map output [13, 8, 8] to internal [8, 8, 13]
+    std::vector<float> piece_matrix(8 * 8 * 13, 0.0f);
+    for (int ch = 0; ch < 13; ++ch) {
+        for (int r = 0; r < 8; ++r) {
+            for (int c = 0; c < 8; ++c) {
+                // CNN format: [channel][row][col]
+                // State format: [row][col][channel]
+                piece_matrix[r * 8 * 13 + c * 13 + ch] = result.board[ch * 64 + r * 8 + c];
+            }
+        }
+    }
+    
+    return piece_matrix;
+}
+
 cv::Mat ChessLensImage::get_fen_img() const {
     if (!is_pieces_detected()) {
         throw std::runtime_error("Pieces not detected");
@@ -243,8 +256,32 @@ ChessLensGame1::ChessLensGame1(const ChessLensConfig& config,
                                const std::string& occlusion_detector_path)
     : board_flag(false), config_(config) {
     
-    camera_ = std::make_unique<ImageProvider>(
-        CameraType::PI_FISH, config.camera_interval);
+    CameraSettings camera_settings;
+    camera_settings.width = config.camera_width;
+    camera_settings.height = config.camera_height;
+    camera_settings.role = config.camera_role;
+    camera_settings.full_res = config.camera_full_res;
+    camera_settings.output_size = cv::Size(ChessLensImage::PREP_SIZE, ChessLensImage::PREP_SIZE);
+
+    if (!config.replay_path.empty()) {
+        // Offline replay, bounded by compute unless paced by the original times
+        ReplaySettings replay;
+        replay.pacing = config.replay_original_timing ? ReplayPacing::ORIGINAL : ReplayPacing::NONE;
+        replay.decode_threads = config.replay_decode_threads;
+        replay.read_ahead = std::max(8, 2 * config.replay_decode_threads);
+
+        CameraType replay_type = std::filesystem::is_directory(config.replay_path)
+            ? CameraType::FILES : CameraType::SESSION;
+        camera_ = std::make_unique<ImageProvider>(
+            replay_type, config.camera_interval, config.replay_path, config.latest_frame_capture,
+            camera_settings, replay);
+    } else {
+        camera_ = std::make_unique<ImageProvider>(
+            CameraType::PI_FISH, config.camera_interval, "", config.latest_frame_capture, camera_settings);
+    }
+
+    if (!config.record_path.empty())
+        camera_->start_recording(config.record_path);
     
     current_img_ = std::make_unique<ChessLensImage>(
         piece_detector_path, occlusion_detector_path);
@@ -252,6 +289,10 @@ ChessLensGame1::ChessLensGame1(const ChessLensConfig& config,
     clear();
 }
 
+ChessLensGame1::~ChessLensGame1() {
+    stop_pipeline();
+}
+
 void ChessLensGame1::clear() {
     board_detection_ = cv::Mat();
     board_fails_count_ = 0;
@@ -306,6 +347,24 @@ std::vector<float> ChessLensGame1::prep_probs(const std::vector<float>& probs) {
 }
 
 std::vector<float> ChessLensGame1::process_img() {
+    if (!filter_img()) {
+        return {};
+    }
+    
+    auto t4 = std::chrono::high_resolution_clock::now();
+    
+    // Piece Recognition
+    auto [piece_matrix, fen] = current_img_->recognize_pieces();
+    auto probs = prep_probs(piece_matrix);
+    avg_times.piece_count++;
+    
+    auto t5 = std::chrono::high_resolution_clock::now();
+    avg_times.piece_recognition += std::chrono::duration<double>(t5 - t4).count();
+    
+    return probs;
+}
+
+bool ChessLensGame1::filter_img() {
     auto t1 = std::chrono::high_resolution_clock::now();
     
     // Board Detection
@@ -328,7 +387,7 @@ std::vector<float> ChessLensGame1::process_img() {
             // cout << "board_fails_count " << board_fails_count_ << " board_flag " << board_flag.get() << " max_bd_fails " << config_.max_bd_fails;
             if (board_fails_count_ >= config_.max_bd_fails || board_detection_.empty()) {
                 board_flag.set(true);
-                return {};
+                return false;
             }
         }
     }
@@ -350,7 +409,7 @@ std::vector<float> ChessLensGame1::process_img() {
     
     cout << "Wakeup: " << (is_wakeup ? "True" : "False") << "\n";
     if (!is_wakeup) {
-        return {};
+        return false;
     }
     last_wakeup_ = t_;
     
@@ -362,27 +421,150 @@ std::vector<float> ChessLensGame1::process_img() {
     avg_times.occlusion_count++;
     cout << "Occlusion: " << (is_occluded ? "True" : "False") << "\n";
     if (is_occluded) {
-        return {};
+        return false;
     }
     
     auto t4 = std::chrono::high_resolution_clock::now();
     avg_times.occlusion += std::chrono::duration<double>(t4 - t3).count();
     
-    // Piece Recognition
-    auto [piece_matrix, fen] = current_img_->recognize_pieces();
-    auto probs = prep_probs(piece_matrix);
-    avg_times.piece_count++;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Pipeline: capture -> geometry -> piece recognition -> next_frame() (HMM)
+// Each stage only touches its own part of the state: the camera, the board /
+// wakeup / occlusion models with the frame counters, and the piece detector.
+// ----------------------------------------------------------------------------
+
+void ChessLensGame1::start_pipeline() {
+    stop_pipeline();
     
-    auto t5 = std::chrono::high_resolution_clock::now();
-    avg_times.piece_recognition += std::chrono::duration<double>(t5 - t4).count();
+    size_t queue_size = std::max(1, config_.pipeline_queue_size);
+    captured_ = std::make_unique<Utils::BoundedQueue<PipelineFrame>>(queue_size);
+    filtered_ = std::make_unique<Utils::BoundedQueue<PipelineFrame>>(queue_size);
+    recognized_ = std::make_unique<Utils::BoundedQueue<PipelineFrame>>(queue_size);
+    pipeline_error_ = nullptr;
     
-    return probs;
+    stages_.emplace_back(&ChessLensGame1::capture_stage, this);
+    stages_.emplace_back(&ChessLensGame1::geometry_stage, this);
+    stages_.emplace_back(&ChessLensGame1::cnn_stage, this);
+}
+
+bool ChessLensGame1::next_frame(PipelineFrame& frame) {
+    if (recognized_ && recognized_->pop(frame)) {
+        return true;
+    }
+    
+    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+    if (pipeline_error_) {
+        std::rethrow_exception(pipeline_error_);
+    }
+    return false;
+}
+
+void ChessLensGame1::stop_pipeline() {
+    if (captured_) captured_->close();
+    if (filtered_) filtered_->close();
+    if (recognized_) recognized_->close();
+    
+    for (auto& stage : stages_) {
+        stage.join();
+    }
+    stages_.clear();
+}
+
+void ChessLensGame1::set_pipeline_error() {
+    {
+        std::lock_guard<std::mutex> lock(pipeline_mutex_);
+        if (!pipeline_error_) pipeline_error_ = std::current_exception();
+    }
+    captured_->close();
+    filtered_->close();
+    recognized_->close();
+}
+
+void ChessLensGame1::capture_stage() {
+    try {
+        int index = 0;
+        while (true) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+            PipelineFrame frame;
+            frame.img = camera_->take_image(frame.capture_time);
+            if (frame.img.empty()) {
+                break;
+            }
+            auto t2 = std::chrono::high_resolution_clock::now();
+            avg_times.img_capture += std::chrono::duration<double>(t2 - t1).count();
+            avg_times.img_capture_count++;
+            
+            frame.index = index++;
+            if (!captured_->push(std::move(frame))) {
+                break;
+            }
+        }
+    } catch (...) {
+        set_pipeline_error();
+    }
+    captured_->close();
+}
+
+void ChessLensGame1::geometry_stage() {
+    try {
+        PipelineFrame frame;
+        while (captured_->pop(frame)) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+            current_img_->load_image(frame.img);
+            auto t2 = std::chrono::high_resolution_clock::now();
+            avg_times.load += std::chrono::duration<double>(t2 - t1).count();
+            avg_times.load_count++;
+            avg_times.count++;
+            
+            bool is_passed = filter_img();
+            t_++;
+            
+            // Corners are copied, the averaged detection is updated in place
+            frame.img = current_img_->img_;
+            frame.board_corners = is_passed ? current_img_->board_corners_.clone() : cv::Mat();
+            frame.is_board_lost = !is_passed && board_flag.get();
+            if (!filtered_->push(std::move(frame))) {
+                break;
+            }
+        }
+    } catch (...) {
+        set_pipeline_error();
+    }
+    filtered_->close();
+}
+
+void ChessLensGame1::cnn_stage() {
+    try {
+        PipelineFrame frame;
+        while (filtered_->pop(frame)) {
+            if (!frame.board_corners.empty()) {
+                auto t1 = std::chrono::high_resolution_clock::now();
+                frame.probs = prep_probs(current_img_->detect_pieces(frame.img, frame.board_corners));
+                avg_times.piece_count++;
+                auto t2 = std::chrono::high_resolution_clock::now();
+                avg_times.piece_recognition += std::chrono::duration<double>(t2 - t1).count();
+            }
+            if (!recognized_->push(std::move(frame))) {
+                break;
+            }
+        }
+    } catch (...) {
+        set_pipeline_error();
+    }
+    recognized_->close();
 }
 
 double ChessLensGame1::sleep_time() {
     return camera_->total_wait_time;
 }
 
+uint64_t ChessLensGame1::dropped_frames() {
+    return camera_->dropped_frames;
+}
+
 void ChessLensGame1::quit() {
     camera_->quit();
 }
@@ -395,16 +577,38 @@ ChessLensGame2::ChessLensGame2(const ChessLensConfig& config)
     : config_(config),
       latest_bound_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR") {
     
+    // Game logs stay open for the whole game, written through a buffer
+    if (!config_.game_out_path.empty()) {
+        // Opened once: fail now rather than lose the whole game log
+        std::string fen_log_path = config_.game_out_path + "/game_fens.csv";
+        fen_log_ = std::make_unique<Utils::BufferedWriter>(
+            fen_log_path, 64 * 1024, config_.game_log_flush_interval);
+        if (!fen_log_->is_open())
+            throw std::runtime_error("Failed to open game log: " + fen_log_path);
+        if (config_.game_log_binary) {
+            std::string record_log_path = config_.game_out_path + "/game_fens.bin";
+            record_log_ = std::make_unique<Utils::BufferedWriter>(
+                record_log_path, 64 * 1024, config_.game_log_flush_interval);
+            if (!record_log_->is_open())
+                throw std::runtime_error("Failed to open game log: " + record_log_path);
+        }
+    }
+    
     clear();
 }
 
 void ChessLensGame2::clear() {
     orientation_ = Orientation::UNKNOWN;
+    fen_watermark_ = -1;
     context_model_ = std::make_unique<ContextAwareModels::HMM>(
         config_.context_breadth, 
         config_.context_delay, 
-        config_.context_bind_period
+        config_.context_bind_period,
+        config_.context_threads
     );
+    if (config_.context_min_breadth > 0) {
+        context_model_->set_adaptive_width(config_.context_min_breadth, config_.context_width_gap);
+    }
 }
 
 void ChessLensGame2::calc_orientation(const std::vector<float>& piece_matrix) {
@@ -497,6 +701,10 @@ std::vector<float> ChessLensGame2::prep_probs(const std::vector<float>& probs) {
 }
 
 void ChessLensGame2::operate(const std::vector<float>& piece_matrix) {
+    operate(piece_matrix, std::chrono::steady_clock::now());
+}
+
+void ChessLensGame2::operate(const std::vector<float>& piece_matrix, std::chrono::steady_clock::time_point frame_time) {
     if (orientation_ == Orientation::UNKNOWN) {
         calc_orientation(piece_matrix);
     }
@@ -509,16 +717,21 @@ void ChessLensGame2::operate(const std::vector<float>& piece_matrix) {
 
     int timestep = context_model_->top_t() + 1;
     
-    timestamp_map_[timestep] = std::chrono::steady_clock::now();
+    timestamp_map_[timestep] = frame_time;
     context_model_->set_probs(timestep, prepped, timestamp_map_[timestep]);
     
     auto t2 = std::chrono::high_resolution_clock::now();
     
     avg_times.hmm += std::chrono::duration<double>(t2 - t1).count();
+    avg_times.hmm_width += context_model_->width(timestep);
     avg_times.hmm_count++;
     avg_times.count++;
 }
 
+int ChessLensGame2::width() const {
+    return context_model_->width(context_model_->top_t());
+}
+
 void ChessLensGame2::update_bindings() {
     auto now = std::chrono::steady_clock::now();
     
@@ -527,6 +740,9 @@ void ChessLensGame2::update_bindings() {
     if (isbound || config_.context_continuous) {
         get_latest_fens();
     }
+    
+    if (fen_log_) fen_log_->flush_if_due();
+    if (record_log_) record_log_->flush_if_due();
 }
 
 void ChessLensGame2::bind() {
@@ -558,15 +774,26 @@ std::vector<std::string> ChessLensGame2::get_history(bool include_non_bound) {
 }
 
 void ChessLensGame2::get_latest_fens() {
-    auto fens = get_history(config_.context_continuous);
+    // Bound timesteps never change, only the ones past the watermark are read;
+    // the unbound suffix (continuous mode) is read again on every call
+    int from_timestep = fen_watermark_ + 1;
+    auto hist = context_model_->get_history(config_.context_continuous, from_timestep);
+    fen_watermark_ = context_model_->top_bind_t();
     
     // Remove duplicates and already broadcasted FENs
     std::vector<std::string> new_fens;
-    for (const auto& fen : fens) {
-        if (std::find(broadcasted_fens_.begin(), broadcasted_fens_.end(), fen) 
-            == broadcasted_fens_.end()) {
+    std::vector<int> new_rows;
+    for (int i = 0; i < hist.shape.i; i++) {
+        auto row = hist.data_.begin() + (i*64);
+        
+        // Board unchanged since the previous timestep, its FEN was handled already
+        if (i > 0 && std::equal(row, row + 64, row - 64)) continue;
+        
+        std::vector<int> span(row, row + 64);
+        std::string fen = ChessUtils::tensor_to_fen(span);
+        if (broadcasted_fens_.insert(fen).second) {
             new_fens.push_back(fen);
-            broadcasted_fens_.push_back(fen);
+            new_rows.push_back(i);
         }
     }
     
@@ -581,16 +808,38 @@ void ChessLensGame2::get_latest_fens() {
         config_.fen_update(latest_bound_fen);
     }
     
-    if (!config_.game_out_path.empty() && !new_fens.empty()) {
-        std::ofstream out(config_.game_out_path + "/game_fens.csv", std::ios::app);
+    if (fen_log_) {
         for (const auto& fen : new_fens) {
-            out << fen << "\n";
+            fen_log_->write_line(fen);
+        }
+    }
+    
+    if (record_log_) {
+        for (int i : new_rows) {
+            GameLogRecord record;
+            record.timestep = from_timestep + i;
+            auto it = timestamp_map_.find(record.timestep);
+            record.timestamp_us = (it == timestamp_map_.end()) ? 0 :
+                std::chrono::duration_cast<std::chrono::microseconds>(it->second.time_since_epoch()).count();
+            for (int k = 0; k < 64; k++) {
+                record.board[k] = static_cast<uint8_t>(hist.data_[i * 64 + k]);
+            }
+            record_log_->write(&record, sizeof(record));
         }
     }
+    
+    // Frame times of bound timesteps are not needed anymore
+    timestamp_map_.erase(timestamp_map_.begin(), timestamp_map_.upper_bound(fen_watermark_));
 }
 
 void ChessLensGame2::quit() {
-    // Cleanup if needed
+    // Make sure the game logs reach the storage
+    if (fen_log_) fen_log_->flush(true);
+    if (record_log_) record_log_->flush(true);
+}
+
+uint64_t ChessLensGame2::log_errors() const {
+    return (fen_log_ ? fen_log_->errors() : 0) + (record_log_ ? record_log_->errors() : 0);
 }
 
 // ============================================================================
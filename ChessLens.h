@@ -7,6 +7,10 @@
 #include <memory>
 #include <chrono>
 #include <map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <exception>
 
 #include "ImageProvider.h"
 #include "BoardDetection.h"
@@ -15,6 +19,8 @@
 #include "PieceDetection.h"
 #include "ContextAwareModels/HMM.h"
 #include "Utils/Utils.h"
+#include "Utils/BufferedWriter.h"
+#include "Utils/BoundedQueue.h"
 
 /**
  * Configuration structure for ChessLens system
@@ -22,6 +28,15 @@
 struct ChessLensConfig {
     // Camera settings
     double camera_interval = 0.2;
+    bool latest_frame_capture = false;  // Capture in the background, always process the newest frame
+    int camera_width = 0;           // Processing stream scaled by the ISP, 0 = 640 on the short side with
+    int camera_height = 0;          // the fisheye calibration's aspect ratio, 1920x1080 without calibration
+    CaptureRole camera_role = CaptureRole::STILL;
+    bool camera_full_res = false;   // Also a full resolution stream, captured on demand (always on with a calibration)
+    std::string replay_path = "";   // Replay an image directory or a session file instead of the camera
+    bool replay_original_timing = false; // Pace the replay by the capture times, else as fast as processed
+    std::string record_path = "";   // Record the camera frames to a session file
+    int replay_decode_threads = 2;  // Threads decoding replay images ahead of processing
     
     // Board detection
     int bd_period = 5;              // Detect board every N frames
@@ -35,6 +50,13 @@ struct ChessLensConfig {
     double context_delay = 120.0;   // Delay in seconds before binding
     int context_bind_period = 1;    // Binding check period
     bool context_continuous = false; // Include non-bound states in history
+    int context_threads = 1;        // Threads expanding the HMM search tree (1 = serial)
+    int context_min_breadth = 0;    // Adaptive width between this and context_breadth (0 = fixed width)
+    double context_width_gap = 30.0; // Cost gap between best and k-th hypothesis under which the tree grows
+    
+    // Pipeline settings
+    bool pipelined = false;         // Capture, geometry and piece recognition on their own threads
+    int pipeline_queue_size = 2;    // Frames buffered between two stages
     
     // Feature flags
     bool is_detect_occlusion = true;
@@ -42,9 +64,22 @@ struct ChessLensConfig {
     
     // Output settings
     std::string game_out_path = "";
+    bool game_log_binary = false;         // Also log game_fens.bin records (see GameLogRecord)
+    double game_log_flush_interval = 5.0; // Seconds between game log flushes
     std::function<void(const std::string&)> fen_update = nullptr;
 };
 
+/**
+ * Binary game log record (game_fens.bin), one per broadcast position
+ */
+#pragma pack(push, 1)
+struct GameLogRecord {
+    int64_t timestamp_us;   // Frame time, steady clock microseconds
+    int32_t timestep;
+    uint8_t board[64];      // Labels as in ChessGameState::current_position, rank * 8 + file
+};
+#pragma pack(pop)
+
 /**
  * Average timing statistics
  */
@@ -56,6 +91,7 @@ struct AvgTimes {
     double occlusion = 0.0;
     double piece_recognition = 0.0;
     double hmm = 0.0;
+    double hmm_width = 0.0;         // Sum of HMM search tree widths
 
     int img_capture_count = 0;
     int load_count = 0;
@@ -71,6 +107,18 @@ struct AvgTimes {
     void reset();
 };
 
+/**
+ * Frame travelling through the ChessLensGame1 pipeline
+ */
+struct PipelineFrame {
+    int index = 0;
+    std::chrono::steady_clock::time_point capture_time;
+    cv::Mat img;                    // Resized input image
+    cv::Mat board_corners;          // Set once the frame passed the filters
+    std::vector<float> probs;       // [8, 8, 13], empty if the frame was filtered out
+    bool is_board_lost = false;     // Board detection failed too many times
+};
+
 /**
  * Board orientation relative to camera
  */
@@ -88,6 +136,8 @@ enum class Orientation {
  */
 class ChessLensImage {
 public:
+    static constexpr int PREP_SIZE = 640;   // Side of the processed image
+
     ChessLensImage(const std::string& piece_detector_path,
                    const std::string& occlusion_detector_path);
     
@@ -108,6 +158,8 @@ public:
     bool is_wakeup();
     bool is_occluded();
     std::pair<std::vector<float>, std::string> recognize_pieces(bool verbose = false);
+    // Piece recognition of any image, uses no per-image state (pipeline CNN stage)
+    std::vector<float> detect_pieces(const cv::Mat& img, const cv::Mat& board_corners);
     
     // Output
     cv::Mat get_fen_img() const;
@@ -145,6 +197,7 @@ public:
     ChessLensGame1(const ChessLensConfig& config,
                    const std::string& piece_detector_path,
                    const std::string& occlusion_detector_path);
+    ~ChessLensGame1();
     
     void clear();
     
@@ -152,6 +205,12 @@ public:
     std::vector<float> operate();  // Process next camera frame
     std::vector<float> set_img(const cv::Mat& img);  // Process specific image
     
+    // Pipelined processing: capture, geometry (board, wakeup, occlusion) and
+    // piece recognition stages on their own threads, connected by bounded queues
+    void start_pipeline();
+    bool next_frame(PipelineFrame& frame);  // false once the camera ran out of frames
+    void stop_pipeline();
+    
     void quit();
     
     // Observable flag for board detection failures
@@ -161,6 +220,7 @@ public:
     AvgTimes avg_times;
 
     double sleep_time();
+    uint64_t dropped_frames();  // Frames the camera replaced before they were processed
 
 private:
     std::unique_ptr<ImageProvider> camera_;
@@ -174,10 +234,24 @@ private:
     
     ChessLensConfig config_;
     
+    // Pipeline
+    std::unique_ptr<Utils::BoundedQueue<PipelineFrame>> captured_;
+    std::unique_ptr<Utils::BoundedQueue<PipelineFrame>> filtered_;
+    std::unique_ptr<Utils::BoundedQueue<PipelineFrame>> recognized_;
+    std::vector<std::thread> stages_;
+    std::exception_ptr pipeline_error_;
+    std::mutex pipeline_mutex_;
+    
+    void capture_stage();
+    void geometry_stage();
+    void cnn_stage();
+    void set_pipeline_error();
+    
     bool detect_wakeup();
     bool detect_occlusion();
     std::vector<float> prep_probs(const std::vector<float>& probs);
     std::vector<float> process_img();
+    bool filter_img();  // Board detection, wakeup and occlusion; true if pieces should be recognized
 };
 
 /**
@@ -193,6 +267,7 @@ public:
     
     // Processing
     void operate(const std::vector<float>& piece_matrix);
+    void operate(const std::vector<float>& piece_matrix, std::chrono::steady_clock::time_point frame_time);
     void update_bindings();
     void bind();
     
@@ -200,13 +275,20 @@ public:
     std::vector<std::string> get_history(bool include_non_bound = false);
     void get_latest_fens();
     
+    // Flushes the game logs durably
     void quit();
     
+    // Failed writes to the game logs, whose data is lost
+    uint64_t log_errors() const;
+    
     // Performance tracking
     AvgTimes avg_times;
     
     // Latest bound FEN position
     std::string latest_bound_fen;
+    
+    // Search tree width used for the latest frame
+    int width() const;
 
 private:
     std::unique_ptr<ContextAwareModels::HMM> context_model_;
@@ -215,7 +297,10 @@ private:
     
     ChessLensConfig config_;
     
-    std::vector<std::string> broadcasted_fens_;
+    std::unordered_set<std::string> broadcasted_fens_;
+    std::unique_ptr<Utils::BufferedWriter> fen_log_;    // game_fens.csv
+    std::unique_ptr<Utils::BufferedWriter> record_log_; // game_fens.bin
+    int fen_watermark_ = -1;        // Last bound timestep already turned into FENs
     std::map<int, std::chrono::steady_clock::time_point> timestamp_map_;
     
     void calc_orientation(const std::vector<float>& piece_matrix);
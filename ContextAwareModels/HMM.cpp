@@ -3,11 +3,11 @@
 
 namespace ContextAwareModels {
 
-HMM::HMM(int breadth, double delay, int bind_period)
+HMM::HMM(int breadth, double delay, int bind_period, int n_threads)
     : breadth_(breadth), delay_(delay), bind_period_(bind_period) {
     
     // Create underlying ChessHMM with starting position
-    model_ = new ChessHMM(breadth, STARTING_POSITION_FEN);
+    model_ = new ChessHMM(breadth, STARTING_POSITION_FEN, n_threads);
 }
 
 HMM::~HMM() {
@@ -24,6 +24,7 @@ int HMM::top_bind_t() const {
 
 void HMM::bind() {
     model_->bind(model_->top_t());
+    timestamp_map_.clear();
 }
 
 void HMM::set_probs(int timestep, 
@@ -44,6 +45,14 @@ void HMM::set_probs(int timestep,
     // }
 }
 
+void HMM::set_adaptive_width(int min_breadth, double width_gap) {
+    model_->set_adaptive_width(min_breadth, width_gap);
+}
+
+int HMM::width(int timestep) const {
+    return model_->get_width(timestep);
+}
+
 bool HMM::check_bind(const std::chrono::steady_clock::time_point& current_time) {
     int bind_at = -1;
     
@@ -66,6 +75,7 @@ bool HMM::check_bind(const std::chrono::steady_clock::time_point& current_time)
     
     try {
         model_->bind(bind_at);
+        timestamp_map_.erase(timestamp_map_.begin(), timestamp_map_.upper_bound(bind_at));
         return true;
     } catch (...) {
         // Binding failed
@@ -77,8 +87,8 @@ std::string HMM::print(int timestep) const {
     return model_->print(timestep);
 }
 
-Utils::Matrix<int> HMM::get_history(bool include_non_bound) const {
-    return model_->get_history(include_non_bound);
+Utils::Matrix<int> HMM::get_history(bool include_non_bound, int from_timestep) const {
+    return model_->get_history(include_non_bound, from_timestep);
 }
 
 std::string HMM::get_pgn() const {
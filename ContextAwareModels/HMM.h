@@ -20,8 +20,9 @@ public:
      * @param breadth Maximum width of search tree
      * @param delay Time delay (in seconds) before binding positions
      * @param bind_period How often to check for binding (not currently used)
+     * @param n_threads Threads expanding the search tree (1 = serial, results are identical)
      */
-    HMM(int breadth = 30, double delay = 120.0, int bind_period = 20);
+    HMM(int breadth = 30, double delay = 120.0, int bind_period = 20, int n_threads = 1);
     
     /**
      * Destructor
@@ -56,6 +57,22 @@ public:
                    const std::vector<float>& piece_matrix, 
                    const std::chrono::steady_clock::time_point& actual_frame_time);
     
+    /**
+     * Let the search tree width adapt per frame, between min_breadth and breadth
+     * 
+     * @param min_breadth Minimum width of search tree
+     * @param width_gap Cost gap between the best and k-th hypothesis under which the tree grows
+     */
+    void set_adaptive_width(int min_breadth, double width_gap);
+    
+    /**
+     * Get the search tree width used for a timestep
+     * 
+     * @param timestep Timestep index
+     * @return Number of hypotheses kept
+     */
+    int width(int timestep) const;
+    
     /**
      * Check if sufficient time has passed and bind if ready
      * 
@@ -76,9 +93,10 @@ public:
      * Get history of board positions
      * 
      * @param include_non_bound Include unbound positions
+     * @param from_timestep First timestep returned
      * @return Vector of board state indices
      */
-    Utils::Matrix<int> get_history(bool include_non_bound = false) const;
+    Utils::Matrix<int> get_history(bool include_non_bound = false, int from_timestep = 0) const;
     
     /**
      * Get PGN string of the game
@@ -99,7 +117,7 @@ private:
     int bind_period_;
     double delay_;
     
-    // Map timestep to real-world time
+    // Map timestep to real-world time, for timesteps not bound yet
     std::map<int, std::chrono::steady_clock::time_point> timestamp_map_;
 };
 
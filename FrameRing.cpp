@@ -0,0 +1,95 @@
+#include "FrameRing.h"
+#include "Utils/SharedMat.h"
+
+std::shared_ptr<FrameRing> FrameRing::create(std::vector<Buffer> buffers, Requeue requeue, Unmap unmap) {
+    return std::shared_ptr<FrameRing>(new FrameRing(std::move(buffers), std::move(requeue), std::move(unmap)));
+}
+
+FrameRing::FrameRing(std::vector<Buffer> buffers, Requeue requeue, Unmap unmap)
+    : buffers_(std::move(buffers)),
+      states_(buffers_.size(), State::QUEUED),
+      requeue_(std::move(requeue)),
+      unmap_(std::move(unmap)) {}
+
+FrameRing::~FrameRing() {
+    if (unmap_) {
+        for (const auto& buffer : buffers_) unmap_(buffer);
+    }
+}
+
+void FrameRing::complete(size_t index) {
+    int stale = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (newest_ >= 0) {
+            stale = newest_;
+            states_[stale] = State::QUEUED;
+            dropped_++;
+        }
+        states_[index] = State::READY;
+        newest_ = (int)index;
+        if (is_stopped_) stale = -1;
+    }
+    cv_.notify_one();
+
+    if (stale >= 0) requeue_((size_t)stale);
+}
+
+void FrameRing::drop(size_t index) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        states_[index] = State::QUEUED;
+        dropped_++;
+        if (is_stopped_) return;
+    }
+    requeue_(index);
+}
+
+void FrameRing::fail(size_t index) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        n_failed_++;
+    }
+    cv_.notify_one();
+    drop(index);
+}
+
+cv::Mat FrameRing::acquire() {
+    size_t index;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return newest_ >= 0 || is_stopped_ || n_failed_ > 0; });
+        if (newest_ < 0) {
+            if (n_failed_ > 0) n_failed_--;
+            return cv::Mat();
+        }
+
+        index = (size_t)newest_;
+        newest_ = -1;
+        states_[index] = State::IN_USE;
+    }
+
+    // The buffer is released with the last copy of the view, which also keeps the ring alive
+    const Buffer& buffer = buffers_[index];
+    auto self = shared_from_this();
+    std::shared_ptr<void> owner(nullptr, [self, index](void*) { self->release(index); });
+    return Utils::shared_mat(buffer.height, buffer.width, CV_8UC3,
+                             static_cast<uchar*>(buffer.data) + buffer.offset, buffer.stride, std::move(owner));
+}
+
+void FrameRing::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_stopped_ = true;
+    }
+    cv_.notify_all();
+}
+
+void FrameRing::release(size_t index) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        states_[index] = State::QUEUED;
+        if (is_stopped_) return;
+    }
+    requeue_(index);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Small ring of camera buffers handed out as zero-copy, reference-counted cv::Mat views
+ *
+ * Every buffer is mapped once by the owner. The camera fills a buffer (complete), the
+ * consumer gets a view of the newest one (acquire), and once the last copy of that view
+ * is released the buffer goes back to the camera (requeue). A filled buffer that was
+ * never acquired is requeued as soon as a newer one completes, and counted as dropped.
+ * Views stay valid after the ring is stopped; the memory is released with the last view.
+ *
+ * Driven by LibCameraCapture, or by any fake source calling complete() in tests.
+ */
+class FrameRing : public std::enable_shared_from_this<FrameRing> {
+public:
+    struct Buffer {
+        void* data;         // Mapped once, read only
+        size_t length;
+        size_t offset;      // First pixel within data
+        int width;
+        int height;
+        size_t stride;      // Bytes per row
+    };
+
+    // Give buffer index back to the camera
+    using Requeue = std::function<void(size_t index)>;
+    // Release the memory of a buffer (e.g. munmap), called once the ring and all views are gone
+    using Unmap = std::function<void(const Buffer& buffer)>;
+
+    static std::shared_ptr<FrameRing> create(std::vector<Buffer> buffers, Requeue requeue, Unmap unmap = nullptr);
+    ~FrameRing();
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    /**
+     * Buffer index was filled by the camera
+     */
+    void complete(size_t index);
+
+    /**
+     * Buffer index came back from the camera without a frame (cancelled or errored),
+     * it is counted as dropped and requeued straight away
+     */
+    void drop(size_t index);
+
+    /**
+     * Like drop(), and the frame is given up on: a waiting (or the next) acquire() returns
+     * an empty view, unless a frame is ready. For on-demand captures.
+     */
+    void fail(size_t index);
+
+    /**
+     * Wait for a frame newer than the last acquired one
+     * @return Read-only CV_8UC3 view, empty once the ring is stopped or after fail()
+     */
+    cv::Mat acquire();
+
+    /**
+     * No more requeues, wakes acquire()
+     */
+    void stop();
+
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    enum class State { QUEUED, READY, IN_USE };
+
+    FrameRing(std::vector<Buffer> buffers, Requeue requeue, Unmap unmap);
+
+    void release(size_t index);
+
+    std::vector<Buffer> buffers_;
+    std::vector<State> states_;
+    Requeue requeue_;
+    Unmap unmap_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int newest_ = -1;           // READY buffer waiting for acquire
+    int n_failed_ = 0;          // Failures not yet reported by acquire
+    bool is_stopped_ = false;
+
+    std::atomic<uint64_t> dropped_{0};
+};
@@ -3,6 +3,10 @@
 #include <thread>
 #include <regex>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 #include <iostream>
 
 namespace fs = std::filesystem;
@@ -10,7 +14,7 @@ namespace fs = std::filesystem;
 static std::vector<std::string> natural_sort(const std::vector<std::string>& files) {
     auto key = [](const std::string& s) {
         std::vector<std::string> parts;
-        std::regex re("(\\d+)|(\\D+)");
+        static const std::regex re("(\\d+)|(\\D+)");
         auto it = std::sregex_iterator(s.begin(), s.end(), re);
         auto end = std::sregex_iterator();
         for (; it != end; ++it)
@@ -18,13 +22,17 @@ static std::vector<std::string> natural_sort(const std::vector<std::string>& fil
         return parts;
     };
 
-    auto sorted = files;
-    std::sort(sorted.begin(), sorted.end(),
-        [&](const std::string& a, const std::string& b) {
-            auto ka = key(a);
-            auto kb = key(b);
-            return ka < kb;
-        });
+    // Keys are parsed once, long recordings have tens of thousands of frames
+    std::vector<std::pair<std::vector<std::string>, std::string>> keyed;
+    keyed.reserve(files.size());
+    for (const auto& file : files)
+        keyed.emplace_back(key(file), file);
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<std::string> sorted;
+    sorted.reserve(keyed.size());
+    for (auto& item : keyed)
+        sorted.push_back(std::move(item.second));
     return sorted;
 }
 
@@ -39,9 +47,11 @@ std::vector<std::string> ImageProvider::load_images(const std::string& dir) {
     return natural_sort(files);
 }
 
-void ImageProvider::setup_pi_camera() {
+void ImageProvider::setup_pi_camera(const CameraSettings& settings) {
     // piCam_ = std::make_unique<LibCameraCapture>(1280, 720);
-    piCam_ = std::make_unique<LibCameraCapture>(1920, 1080);
+    piCam_ = std::make_unique<LibCameraCapture>(
+        settings.width, settings.height, settings.role,
+        settings.full_res, settings.full_width, settings.full_height);
     // piCam_ = std::make_unique<LibCameraCapture>(2592, 1944);
     // piCam_ = std::make_unique<LibCameraCapture>(1640, 1232);
 
@@ -59,12 +69,129 @@ void ImageProvider::setup_pi_camera() {
     // cap_.set(cv::CAP_PROP_FPS, 30);
 }
 
+static constexpr int DEFAULT_PROCESSING_SIDE = 640;  // ChessLensImage::PREP_SIZE
+static const cv::Size DEFAULT_PI_SIZE(1920, 1080);   // Without a calibration
+static constexpr size_t RECORD_QUEUE_SIZE = 8;       // Frames waiting for the session writer
+
+// Processing stream size for a calibration size: same aspect ratio, short_side on the short side
+static void processing_size(const cv::Size& calib_size, int short_side, int& width, int& height) {
+    double scale = std::min(1.0, (double)short_side / std::min(calib_size.width, calib_size.height));
+    width = (int)std::lround(calib_size.width * scale / 2) * 2;
+    height = (int)std::lround(calib_size.height * scale / 2) * 2;
+}
+
+// FNV-1a of the file contents, 0 if it cannot be read
+static uint64_t file_hash(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return 0;
+
+    uint64_t hash = 14695981039346656037ull;
+    char buffer[4096];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        for (std::streamsize i = 0; i < file.gcount(); i++) {
+            hash ^= (uint8_t)buffer[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+// Remap cache: magic, output rows and cols (int32), then the CV_16SC2 and CV_16UC1 maps
+static const char MAP_CACHE_MAGIC[8] = {'C', 'L', 'M', 'A', 'P', '1', 0, 0};
+
+static bool load_maps(const std::string& path, const cv::Size& out_size, cv::Mat& map1, cv::Mat& map2) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    char magic[8];
+    int32_t rows, cols;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&rows), sizeof(rows));
+    file.read(reinterpret_cast<char*>(&cols), sizeof(cols));
+    if (!file || std::memcmp(magic, MAP_CACHE_MAGIC, sizeof(magic)) != 0 ||
+        rows != out_size.height || cols != out_size.width)
+        return false;
+
+    map1.create(rows, cols, CV_16SC2);
+    map2.create(rows, cols, CV_16UC1);
+    file.read(reinterpret_cast<char*>(map1.data), map1.total() * map1.elemSize());
+    file.read(reinterpret_cast<char*>(map2.data), map2.total() * map2.elemSize());
+    return (bool)file;
+}
+
+static void save_maps(const std::string& path, const cv::Mat& map1, const cv::Mat& map2) {
+    // Written aside and renamed, a concurrent or interrupted run never reads half a file
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return;
+        int32_t rows = map1.rows, cols = map1.cols;
+        file.write(MAP_CACHE_MAGIC, sizeof(MAP_CACHE_MAGIC));
+        file.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+        file.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
+        file.write(reinterpret_cast<const char*>(map1.data), map1.total() * map1.elemSize());
+        file.write(reinterpret_cast<const char*>(map2.data), map2.total() * map2.elemSize());
+        if (!file)
+            return;
+    }
+    std::error_code ec;
+    fs::rename(tmp_path, path, ec);
+}
+
+std::function<cv::Mat(const cv::Mat&)> ImageProvider::make_undistort(const cv::Mat& K, const cv::Mat& D,
+                                                                     const cv::Size& calib_size, const cv::Size& size,
+                                                                     const cv::Size& out_size,
+                                                                     const std::string& cache_prefix) {
+    std::string cache_path;
+    if (!cache_prefix.empty()) {
+        cache_path = cache_prefix + "_" + std::to_string(size.width) + "x" + std::to_string(size.height) +
+                     "_" + std::to_string(out_size.width) + "x" + std::to_string(out_size.height) + ".bin";
+    }
+
+    // Fixed point maps, one pass from the captured frame to the output size
+    cv::Mat map1, map2;
+    if (cache_path.empty() || !load_maps(cache_path, out_size, map1, map2)) {
+        // Intrinsics scale with the image, as long as the field of view is the calibrated one
+        cv::Mat scaled_K = K.clone();
+        cv::Mat row0 = scaled_K.row(0), row1 = scaled_K.row(1);
+        row0 *= (double)size.width / calib_size.width;
+        row1 *= (double)size.height / calib_size.height;
+
+        cv::Mat newK;
+        cv::fisheye::estimateNewCameraMatrixForUndistortRectify(scaled_K, D, size, cv::Mat::eye(3, 3, CV_64F), newK, 1.0);
+
+        // Undistorted image at size, then resized to out_size, as a single projection
+        cv::Mat out_row0 = newK.row(0), out_row1 = newK.row(1);
+        out_row0 *= (double)out_size.width / size.width;
+        out_row1 *= (double)out_size.height / size.height;
+
+        cv::fisheye::initUndistortRectifyMap(scaled_K, D, cv::Mat::eye(3, 3, CV_64F), newK, out_size, CV_16SC2, map1, map2);
+
+        if (!cache_path.empty())
+            save_maps(cache_path, map1, map2);
+    }
+
+    return [map1, map2](const cv::Mat& img) {
+        cv::Mat out;
+        cv::remap(img, out, map1, map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+        return out;
+    };
+}
+
 ImageProvider::ImageProvider(CameraType camera,
                              double interval,
-                             const std::string& data_dir)
+                             const std::string& data_dir,
+                             bool latest_frame,
+                             const CameraSettings& settings,
+                             const ReplaySettings& replay)
     : camera_(camera),
       interval_(interval),
-      last_img_time_(std::chrono::steady_clock::time_point::min())
+      last_img_time_(std::chrono::steady_clock::time_point::min()),
+      is_latest_frame_(latest_frame),
+      replay_(replay)
 {
     if (camera_ == CameraType::CV2) {
         cap_.open(0);
@@ -73,27 +200,63 @@ ImageProvider::ImageProvider(CameraType camera,
     }
 
     else if (camera_ == CameraType::PI || camera_ == CameraType::PI_FISH) {
-        setup_pi_camera();
+        CameraSettings stream_settings = settings;
+        cv::Mat K, D;
+        cv::Size img_size;
+        std::string cache_prefix;
 
         if (camera_ == CameraType::PI_FISH) {
             // Load fisheye calibration
-            cv::FileStorage storage("models/fisheye_calibration.yaml", cv::FileStorage::READ);
+            const std::string calibration_path = "models/fisheye_calibration.yaml";
+            cv::FileStorage storage(calibration_path, cv::FileStorage::READ);
             if(storage.isOpened()) {
-                cv::Mat K, D;
-                cv::Size img_size;
                 storage["K"] >> K;
                 storage["D"] >> D;
                 storage["img_size"] >> img_size;
 
-                cv::Mat newK, map1, map2;
-                cv::fisheye::estimateNewCameraMatrixForUndistortRectify(K, D, img_size, cv::Mat::eye(3, 3, CV_64F), newK, 1.0);
-                cv::fisheye::initUndistortRectifyMap(K, D, cv::Mat::eye(3, 3, CV_64F), newK, img_size, CV_32FC1, map1, map2);
+                // Remap tables are cached per calibration file content
+                std::ostringstream prefix;
+                prefix << "models/fisheye_map_" << std::hex << file_hash(calibration_path);
+                cache_prefix = prefix.str();
+            }
+        }
+
+        if (!img_size.empty()) {
+            // Streams keep the calibration's aspect ratio, the full one its exact size
+            int short_side = settings.output_size.empty()
+                ? DEFAULT_PROCESSING_SIDE
+                : std::min(settings.output_size.width, settings.output_size.height);
+            if (stream_settings.width <= 0 || stream_settings.height <= 0)
+                processing_size(img_size, short_side, stream_settings.width, stream_settings.height);
+
+            // The sensor mode is picked for the largest stream: a full stream at the calibrated
+            // size gets the mode, and so the crop, the calibration frames were captured with
+            bool is_full_calibrated = stream_settings.full_width == img_size.width &&
+                                      stream_settings.full_height == img_size.height;
+            if (stream_settings.full_width > 0 && stream_settings.full_height > 0 && !is_full_calibrated)
+                throw std::runtime_error("Full resolution stream must have the calibrated size");
+            stream_settings.full_res = true;
+            stream_settings.full_width = img_size.width;
+            stream_settings.full_height = img_size.height;
+        }
+        else if (stream_settings.width <= 0 || stream_settings.height <= 0) {
+            stream_settings.width = DEFAULT_PI_SIZE.width;
+            stream_settings.height = DEFAULT_PI_SIZE.height;
+        }
 
-                postprocess_ = [map1, map2](const cv::Mat& img) {
-                    cv::Mat out;
-                    cv::remap(img, out, map1, map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
-                    return out;
-                };
+        setup_pi_camera(stream_settings);
+
+        if (!img_size.empty()) {
+            if (piCam_->fullFrameSize() != img_size)
+                throw std::runtime_error("Camera has no mode at the calibrated size, the fisheye calibration does not apply");
+
+            // Processing frames go straight to the output size, full resolution ones keep theirs
+            cv::Size frame_size = piCam_->frameSize();
+            cv::Size out_size = settings.output_size.empty() ? frame_size : settings.output_size;
+            postprocess_ = make_undistort(K, D, img_size, frame_size, out_size, cache_prefix);
+            if (piCam_->hasFullStream()) {
+                cv::Size full_size = piCam_->fullFrameSize();
+                full_postprocess_ = make_undistort(K, D, img_size, full_size, full_size, cache_prefix);
             }
         }
     }
@@ -102,17 +265,245 @@ ImageProvider::ImageProvider(CameraType camera,
         if (data_dir.empty() || !fs::is_directory(data_dir))
             throw std::runtime_error("Invalid image directory");
         imgs_to_load_ = load_images(data_dir);
+
+        if (replay_.pacing == ReplayPacing::ORIGINAL && !imgs_to_load_.empty()) {
+            auto first = fs::last_write_time(imgs_to_load_.front());
+            for (const auto& path : imgs_to_load_)
+                img_times_.push_back(std::chrono::duration<double>(fs::last_write_time(path) - first).count());
+        }
+        start_decode_threads();
     }
+
+    else if (camera_ == CameraType::SESSION) {
+        session_ = std::make_unique<Utils::SessionReader>(data_dir);
+
+        if (replay_.pacing == ReplayPacing::ORIGINAL && session_->size() > 0) {
+            int64_t first = session_->timestamp_us(0);
+            for (size_t i = 0; i < session_->size(); i++)
+                img_times_.push_back((session_->timestamp_us(i) - first) * 1e-6);
+        }
+    }
+
+    else if (camera_ == CameraType::SYNTHETIC) {
+        throw std::runtime_error("Synthetic camera needs a frame source");
+    }
+
+    if (is_latest_frame_)
+        start_capture_thread();
+}
+
+ImageProvider::ImageProvider(FrameSource source,
+                             double interval,
+                             bool latest_frame)
+    : camera_(CameraType::SYNTHETIC),
+      interval_(interval),
+      last_img_time_(std::chrono::steady_clock::time_point::min()),
+      is_latest_frame_(latest_frame),
+      source_(std::move(source))
+{
+    if (is_latest_frame_)
+        start_capture_thread();
+}
+
+ImageProvider::~ImageProvider() {
+    // Decoders first, a capture thread waiting for a frame then sees the end
+    stop_decode_threads();
+    stop_capture_thread();
+    stop_recording();
 }
 
 cv::Mat ImageProvider::take_image() {
+    std::chrono::steady_clock::time_point capture_time;
+    return take_image(capture_time);
+}
+
+cv::Mat ImageProvider::take_image(std::chrono::steady_clock::time_point& capture_time) {
+    if (!is_latest_frame_)
+        return grab_image(capture_time);
+
+    // Newest frame from the capture thread, waiting only if it was already taken
+    std::unique_lock<std::mutex> lock(frame_mutex_);
+    frame_cv_.wait(lock, [this] { return has_new_frame_ || is_capture_done_; });
+    if (!has_new_frame_) {
+        if (capture_error_)
+            std::rethrow_exception(capture_error_);
+        return cv::Mat();
+    }
+    has_new_frame_ = false;
+    capture_time = latest_time_;
+    cv::Mat img = latest_frame_;
+    latest_frame_ = cv::Mat();
+    return img;
+}
+
+cv::Mat ImageProvider::take_full_res_image() {
+    if (!piCam_ || !piCam_->hasFullStream())
+        return cv::Mat();
+
+    cv::Mat img = piCam_->captureFull();
+    if (!img.empty() && full_postprocess_)
+        img = full_postprocess_(img);
+    return img;
+}
+
+void ImageProvider::start_capture_thread() {
+    capture_thread_ = std::thread(&ImageProvider::capture_loop, this);
+}
+
+void ImageProvider::capture_loop() {
+    try {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(frame_mutex_);
+                if (is_stopping_)
+                    break;
+            }
+
+            std::chrono::steady_clock::time_point capture_time;
+            cv::Mat img = grab_image(capture_time);
+            if (img.empty())
+                break;
+
+            {
+                std::lock_guard<std::mutex> lock(frame_mutex_);
+                if (has_new_frame_)
+                    dropped_frames++;
+                latest_frame_ = img;
+                latest_time_ = capture_time;
+                has_new_frame_ = true;
+            }
+            frame_cv_.notify_one();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(frame_mutex_);
+        capture_error_ = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(frame_mutex_);
+        is_capture_done_ = true;
+    }
+    frame_cv_.notify_all();
+}
+
+void ImageProvider::stop_capture_thread() {
+    if (!capture_thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(frame_mutex_);
+        is_stopping_ = true;
+    }
+    capture_thread_.join();
+}
+
+void ImageProvider::start_decode_threads() {
+    replay_.read_ahead = std::max(1, replay_.read_ahead);
+    decoded_.assign(replay_.read_ahead, cv::Mat());
+    is_decoded_.assign(replay_.read_ahead, false);
+
+    int n_threads = std::max(1, std::min(replay_.decode_threads, replay_.read_ahead));
+    for (int i = 0; i < n_threads; i++)
+        decode_threads_.emplace_back(&ImageProvider::decode_loop, this);
+}
+
+void ImageProvider::decode_loop() {
+    const size_t read_ahead = decoded_.size();
+    while (true) {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(decode_mutex_);
+            slot_cv_.wait(lock, [&] { return is_decode_stopping_ || next_decode_ < next_take_ + read_ahead; });
+            if (is_decode_stopping_ || next_decode_ >= imgs_to_load_.size())
+                return;
+            index = next_decode_++;
+        }
+
+        // Empty if the file cannot be decoded, take_decoded reports it
+        cv::Mat img = cv::imread(imgs_to_load_[index]);
+        if (!img.empty())
+            cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
+
+        {
+            std::lock_guard<std::mutex> lock(decode_mutex_);
+            decoded_[index % read_ahead] = std::move(img);
+            is_decoded_[index % read_ahead] = true;
+        }
+        decoded_cv_.notify_all();
+    }
+}
+
+cv::Mat ImageProvider::take_decoded() {
+    const size_t read_ahead = decoded_.size();
+    cv::Mat img;
+    size_t index;
+    {
+        std::unique_lock<std::mutex> lock(decode_mutex_);
+        if (next_take_ >= imgs_to_load_.size())
+            return cv::Mat();
+
+        index = next_take_;
+        size_t slot = index % read_ahead;
+        decoded_cv_.wait(lock, [&] { return is_decode_stopping_ || is_decoded_[slot]; });
+        if (!is_decoded_[slot])
+            return cv::Mat();
+
+        img = std::move(decoded_[slot]);
+        decoded_[slot] = cv::Mat();
+        is_decoded_[slot] = false;
+        next_take_++;
+    }
+    slot_cv_.notify_all();
+
+    if (img.empty())
+        throw std::runtime_error("Failed to load image: " + imgs_to_load_[index]);
+
+    pace_replay(index);
+    return img;
+}
+
+void ImageProvider::pace_replay(size_t index) {
+    if (replay_.pacing != ReplayPacing::ORIGINAL)
+        return;
+
+    if (index == 0)
+        replay_start_ = std::chrono::steady_clock::now();
+    auto due = replay_start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(img_times_[index]));
     auto now = std::chrono::steady_clock::now();
-    if (last_img_time_ != std::chrono::steady_clock::time_point::min()) {
+    if (due > now) {
+        add_wait_time(std::chrono::duration<double>(due - now).count());
+        std::this_thread::sleep_until(due);
+    }
+}
+
+void ImageProvider::stop_decode_threads() {
+    {
+        std::lock_guard<std::mutex> lock(decode_mutex_);
+        is_decode_stopping_ = true;
+    }
+    slot_cv_.notify_all();
+    decoded_cv_.notify_all();
+    for (auto& thread : decode_threads_)
+        thread.join();
+    decode_threads_.clear();
+}
+
+void ImageProvider::add_wait_time(double seconds) {
+    // No fetch_add for floating point atomics before C++20
+    double total = total_wait_time.load();
+    while (!total_wait_time.compare_exchange_weak(total, total + seconds)) {}
+}
+
+cv::Mat ImageProvider::grab_image(std::chrono::steady_clock::time_point& capture_time) {
+    auto now = std::chrono::steady_clock::now();
+    bool is_replay = camera_ == CameraType::FILES || camera_ == CameraType::SESSION;
+    bool is_paced = !is_replay || replay_.pacing == ReplayPacing::INTERVAL;
+    if (is_paced && last_img_time_ != std::chrono::steady_clock::time_point::min()) {
         auto elapsed = std::chrono::duration<double>(
             now - last_img_time_).count();
         if (interval_ > 0 && elapsed < interval_) {
             auto sleep_period = interval_ - elapsed;
-            total_wait_time += sleep_period;
+            add_wait_time(sleep_period);
             std::this_thread::sleep_for(
                 std::chrono::duration<double>(sleep_period));
         }
@@ -136,20 +527,88 @@ cv::Mat ImageProvider::take_image() {
     }
 
     else if (camera_ == CameraType::FILES) {
-        if (imgs_to_load_.empty())
+        img = take_decoded();
+        if (img.empty())
             return cv::Mat();
-        img = cv::imread(imgs_to_load_.front());
-        imgs_to_load_.erase(imgs_to_load_.begin());
-        cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
     }
 
+    else if (camera_ == CameraType::SESSION) {
+        // Recorded frames were already post-processed, served in place
+        if (session_index_ >= session_->size())
+            return cv::Mat();
+        size_t index = session_index_++;
+        img = session_->frame(index);
+        pace_replay(index);
+    }
+
+    else if (camera_ == CameraType::SYNTHETIC) {
+        img = source_();
+        if (img.empty())
+            return cv::Mat();
+    }
+    capture_time = std::chrono::steady_clock::now();
+
     if (postprocess_)
         img = postprocess_(img);
 
+    {
+        // Copied: camera views must go back to the camera, and the caller may draw on img
+        std::lock_guard<std::mutex> lock(record_mutex_);
+        if (record_queue_) {
+            RecordedFrame frame{img.clone(), std::chrono::duration_cast<std::chrono::microseconds>(
+                capture_time.time_since_epoch()).count()};
+            if (!record_queue_->try_push(std::move(frame)))
+                unrecorded_frames++;
+        }
+    }
+
     return img;
 }
 
+void ImageProvider::start_recording(const std::string& path) {
+    auto writer = std::make_unique<Utils::SessionWriter>(path);
+    if (!writer->is_open())
+        throw std::runtime_error("Failed to open session file: " + path);
+
+    stop_recording();
+
+    std::lock_guard<std::mutex> lock(record_mutex_);
+    record_queue_ = std::make_unique<Utils::BoundedQueue<RecordedFrame>>(RECORD_QUEUE_SIZE);
+    record_thread_ = std::thread(&ImageProvider::record_loop, this, record_queue_.get(), std::move(writer));
+}
+
+void ImageProvider::stop_recording() {
+    std::unique_ptr<Utils::BoundedQueue<RecordedFrame>> queue;
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(record_mutex_);
+        queue = std::move(record_queue_);
+        thread = std::move(record_thread_);
+    }
+    if (!queue)
+        return;
+
+    // The writer drains what is queued, then flushes
+    queue->close();
+    thread.join();
+}
+
+void ImageProvider::record_loop(Utils::BoundedQueue<RecordedFrame>* queue,
+                                std::unique_ptr<Utils::SessionWriter> writer) {
+    RecordedFrame frame;
+    while (queue->pop(frame)) {
+        if (!writer->write(frame.img, frame.timestamp_us))
+            unrecorded_frames++;    // Not the geometry of the session
+        frame.img.release();
+    }
+    writer->flush(true);
+}
+
 void ImageProvider::quit() {
+    stop_decode_threads();
+    stop_capture_thread();
+    stop_recording();
+
     // if (camera_ == CameraType::CV2) {
     //     cap_.release();
     //     cv::destroyAllWindows();
@@ -4,36 +4,155 @@
 #include <vector>
 #include <functional>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
 #include "LibCameraCapture.h"
+#include "Utils/SessionFile.h"
+#include "Utils/BoundedQueue.h"
 
 enum class CameraType {
     PI,
     PI_FISH,
     CV2,
-    FILES
+    FILES,
+    SYNTHETIC,  // Frames from a user supplied source (tests, replays)
+    SESSION     // Recorded session file (see start_recording), memory mapped
+};
+
+// Pi camera streams (PI / PI_FISH). Sizes of 0 are taken from the fisheye
+// calibration (PI_FISH: calibration aspect ratio with the output size's short
+// side, 640 by default) or default to 1920x1080. With a calibration, the full
+// stream is always configured at the calibrated size: it fixes the sensor mode,
+// so frames have the field of view the calibration was taken at.
+struct CameraSettings {
+    int width = 0;                          // Processing stream
+    int height = 0;
+    CaptureRole role = CaptureRole::STILL;
+    bool full_res = false;                  // Full resolution stream for take_full_res_image
+    int full_width = 0;
+    int full_height = 0;
+    cv::Size output_size;                   // PI_FISH: undistort straight to this size (empty = stream size)
+};
+
+// How FILES frames are paced
+enum class ReplayPacing {
+    INTERVAL,   // At most one frame per interval, like a camera
+    NONE,       // As fast as they are taken, bounded by compute
+    ORIGINAL    // At the original capture times (session timestamps, file modification times)
+};
+
+// Offline replay of an image directory (FILES) or a session (SESSION)
+struct ReplaySettings {
+    ReplayPacing pacing = ReplayPacing::INTERVAL;
+    int decode_threads = 2;                 // Threads decoding images ahead of take_image
+    int read_ahead = 8;                     // Decoded frames kept ready
 };
 
 class ImageProvider {
 public:
+    // Returns an empty image once it has no more frames
+    using FrameSource = std::function<cv::Mat()>;
+
+    // data_dir: image directory (FILES) or session file (SESSION)
+    // latest_frame: a background thread keeps capturing (paced by interval) and
+    // take_image returns the newest frame, older unread frames are dropped
     ImageProvider(CameraType camera,
                   double interval = 0.2,
-                  const std::string& data_dir = "");
+                  const std::string& data_dir = "",
+                  bool latest_frame = false,
+                  const CameraSettings& settings = CameraSettings(),
+                  const ReplaySettings& replay = ReplaySettings());
+    ImageProvider(FrameSource source,
+                  double interval = 0.2,
+                  bool latest_frame = false);
+    ~ImageProvider();
     
     cv::Mat take_image();
+    cv::Mat take_image(std::chrono::steady_clock::time_point& capture_time);
+    // Frame from the full resolution stream (e.g. for crops), empty if not configured
+    cv::Mat take_full_res_image();
     void quit();
 
-    double total_wait_time = 0.0;
+    // Append every frame take_image can return to a session file (SESSION replays it).
+    // Frames are written by a writer thread; if it falls behind, frames are left out
+    // (unrecorded_frames) rather than stalling capture.
+    void start_recording(const std::string& path);
+    void stop_recording();
+
+    std::atomic<double> total_wait_time{0.0};  // Seconds spent pacing, written by the capture thread
+    std::atomic<uint64_t> dropped_frames{0};  // Frames replaced before being taken (latest_frame mode)
+    std::atomic<uint64_t> unrecorded_frames{0};  // Frames left out of the recording
 
 private:
     CameraType camera_;
     double interval_;
     std::chrono::steady_clock::time_point last_img_time_;
     
+    // Latest frame mode
+    bool is_latest_frame_;
+    std::thread capture_thread_;
+    std::mutex frame_mutex_;
+    std::condition_variable frame_cv_;
+    cv::Mat latest_frame_;
+    std::chrono::steady_clock::time_point latest_time_;
+    bool has_new_frame_ = false;
+    bool is_capture_done_ = false;
+    bool is_stopping_ = false;
+    std::exception_ptr capture_error_;
+    
+    FrameSource source_;
+
+    // FILES: decoded in order by a pool of threads, frame i in slot i % read_ahead
+    ReplaySettings replay_;
+    std::vector<std::string> imgs_to_load_;
+    std::vector<double> img_times_;         // Seconds since the first file (ReplayPacing::ORIGINAL)
+    std::chrono::steady_clock::time_point replay_start_;
+    std::vector<std::thread> decode_threads_;
+    std::mutex decode_mutex_;
+    std::condition_variable decoded_cv_;
+    std::condition_variable slot_cv_;
+    std::vector<cv::Mat> decoded_;
+    std::vector<bool> is_decoded_;
+    size_t next_decode_ = 0;
+    size_t next_take_ = 0;
+    bool is_decode_stopping_ = false;
+
+    // SESSION
+    std::unique_ptr<Utils::SessionReader> session_;
+    size_t session_index_ = 0;
+
+    // Recording
+    struct RecordedFrame {
+        cv::Mat img;
+        int64_t timestamp_us = 0;
+    };
+    std::mutex record_mutex_;
+    std::unique_ptr<Utils::BoundedQueue<RecordedFrame>> record_queue_;
+    std::thread record_thread_;
+    
     std::unique_ptr<LibCameraCapture> piCam_;
     cv::VideoCapture cap_;
-    std::vector<std::string> imgs_to_load_;
     std::function<cv::Mat(const cv::Mat&)> postprocess_;
+    std::function<cv::Mat(const cv::Mat&)> full_postprocess_;
 
     static std::vector<std::string> load_images(const std::string& dir);
-    void setup_pi_camera();
+    static std::function<cv::Mat(const cv::Mat&)> make_undistort(const cv::Mat& K, const cv::Mat& D,
+                                                                 const cv::Size& calib_size, const cv::Size& size,
+                                                                 const cv::Size& out_size,
+                                                                 const std::string& cache_prefix);
+    void setup_pi_camera(const CameraSettings& settings);
+    cv::Mat grab_image(std::chrono::steady_clock::time_point& capture_time);
+    void add_wait_time(double seconds);
+    void start_capture_thread();
+    void capture_loop();
+    void stop_capture_thread();
+    void start_decode_threads();
+    void decode_loop();
+    cv::Mat take_decoded();
+    void pace_replay(size_t index);
+    void stop_decode_threads();
+    void record_loop(Utils::BoundedQueue<RecordedFrame>* queue, std::unique_ptr<Utils::SessionWriter> writer);
 };
\ No newline at end of file
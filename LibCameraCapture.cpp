@@ -1,6 +1,5 @@
 #include "LibCameraCapture.h"
 #include <iostream>
-#include <cstring>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <thread>
@@ -8,7 +7,27 @@
 
 using namespace libcamera;
 
-LibCameraCapture::LibCameraCapture(int width, int height): targetWidth_(width), targetHeight_(height) {
+// Cookies of full resolution requests
+static constexpr uint64_t FULL_COOKIE = 1ull << 32;
+// Failed full resolution requests queued again before captureFull() gives up
+static constexpr int MAX_FULL_RETRIES = 3;
+
+static StreamRole to_stream_role(CaptureRole role) {
+    switch (role) {
+        case CaptureRole::VIDEO:      return StreamRole::VideoRecording;
+        case CaptureRole::VIEWFINDER: return StreamRole::Viewfinder;
+        default:                      return StreamRole::StillCapture;
+    }
+}
+
+static const char *status_name(CameraConfiguration::Status status) {
+    return status == CameraConfiguration::Valid ? "Valid" :
+           status == CameraConfiguration::Adjusted ? "Adjusted" : "Invalid";
+}
+
+LibCameraCapture::LibCameraCapture(int width, int height, CaptureRole role,
+                                   bool fullStream, int fullWidth, int fullHeight)
+    : targetWidth_(width), targetHeight_(height) {
     cameraManager_ = std::make_unique<CameraManager>();
     cameraManager_->start();
 
@@ -18,45 +37,77 @@ LibCameraCapture::LibCameraCapture(int width, int height): targetWidth_(width),
     camera_ = cameraManager_->cameras()[0];
     camera_->acquire();
 
-    std::unique_ptr<CameraConfiguration> config =
-        camera_->generateConfiguration({ StreamRole::StillCapture });
+    std::vector<StreamRole> roles = { to_stream_role(role) };
+    if (fullStream)
+        roles.push_back(StreamRole::StillCapture);
 
+    std::unique_ptr<CameraConfiguration> config = camera_->generateConfiguration(roles);
+    if (!config || config->size() != roles.size())
+        throw std::runtime_error("Camera does not support the requested streams");
+
+    // Processing stream: scaled by the ISP, so no full frame is ever copied or undistorted
     StreamConfiguration &streamConfig = config->at(0);
-    // streamConfig.size.width = width;
-    // streamConfig.size.height = height;
+    if (width > 0 && height > 0)
+        streamConfig.size = Size(width, height);
     // streamConfig.pixelFormat = formats::YUV420;
     streamConfig.pixelFormat = formats::RGB888;
-    streamConfig.bufferCount = 4;
+    // Frames are handed out without copying, so a consumer holding a view keeps its
+    // buffer away from the camera: leave room for the pipeline on top of the ring
+    streamConfig.bufferCount = 6;
+
+    if (fullStream) {
+        StreamConfiguration &fullConfig = config->at(1);
+        if (fullWidth > 0 && fullHeight > 0)
+            fullConfig.size = Size(fullWidth, fullHeight);
+        fullConfig.pixelFormat = formats::RGB888;
+        fullConfig.bufferCount = 2;
+    }
 
     CameraConfiguration::Status status = config->validate();
-    std::cout << "Status: " << (status == CameraConfiguration::Valid ? "Valid" : 
-                                status == CameraConfiguration::Adjusted ? "Adjusted" : "Invalid") << std::endl;
-    std::cout << "Final: " << streamConfig.toString() << std::endl;
+    std::cout << "Status: " << status_name(status) << std::endl;
+    for (const StreamConfiguration &cfg : *config)
+        std::cout << "Final: " << cfg.toString() << std::endl;
     // std::cout << "Stride: " << streamConfig.stride << std::endl;
     if (status == CameraConfiguration::Invalid) {
         throw std::runtime_error("Invalid camera configuration");
     }
 
     camera_->configure(config.get());
-    stream_ = streamConfig.stream();
+    stream_ = config->at(0).stream();
+    if (fullStream)
+        fullStream_ = config->at(1).stream();
 
     allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
-    allocator_->allocate(stream_);
-
-    for (const auto &buffer : allocator_->buffers(stream_)) {
-        std::unique_ptr<Request> request = camera_->createRequest();
-
-        // Enable AE + AWB
-        request->controls().set(controls::AeEnable, true);
-        request->controls().set(controls::AwbEnable, true);
-        
-        // CRITICAL: Set crop to full sensor on EVERY request
-        // if (pixelArrayOpt) {
-        //     request->controls().set(controls::ScalerCrop, fullSensorCrop);
-        // }
-
-        request->addBuffer(stream_, buffer.get());
-        requests_.push_back(std::move(request));
+    auto unmap = [](const FrameRing::Buffer &buffer) {
+        munmap(buffer.data, buffer.length);
+    };
+
+    ring_ = FrameRing::create(
+        createRequests(stream_, 0, requests_),
+        [this](size_t index) {
+            if (!running_)
+                return;
+            Request *request = requests_[index].get();
+            request->reuse(Request::ReuseBuffers);
+            pendingRequests_++;
+            camera_->queueRequest(request);
+        },
+        unmap);
+
+    if (fullStream) {
+        // Full resolution requests are only queued by captureFull()
+        fullRing_ = FrameRing::create(
+            createRequests(fullStream_, FULL_COOKIE, fullRequests_),
+            [this](size_t index) {
+                {
+                    std::lock_guard<std::mutex> lock(fullMutex_);
+                    freeFull_.push_back(index);
+                }
+                fullCv_.notify_one();
+            },
+            unmap);
+        for (size_t i = 0; i < fullRequests_.size(); i++)
+            freeFull_.push_back(i);
     }
 
     camera_->requestCompleted.connect(this, &LibCameraCapture::requestComplete);
@@ -82,9 +133,54 @@ LibCameraCapture::LibCameraCapture(int width, int height): targetWidth_(width),
     std::cout << "=== Camera initialized ===" << std::endl;
 }
 
+std::vector<FrameRing::Buffer> LibCameraCapture::createRequests(Stream *stream, uint64_t cookieBase,
+                                                                std::vector<std::unique_ptr<Request>> &requests) {
+    if (allocator_->allocate(stream) < 0)
+        throw std::runtime_error("Failed to allocate camera buffers");
+
+    // Map every buffer once, frames are then read in place
+    const libcamera::StreamConfiguration &cfg = stream->configuration();
+    std::vector<FrameRing::Buffer> mapped;
+
+    for (const auto &buffer : allocator_->buffers(stream)) {
+        const FrameBuffer::Plane &plane = buffer->planes()[0];
+        size_t length = plane.offset + plane.length;
+        void *data = mmap(nullptr, length, PROT_READ, MAP_SHARED, plane.fd.get(), 0);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Failed to map camera buffer");
+
+        mapped.push_back({ data, length, plane.offset,
+                           (int)cfg.size.width, (int)cfg.size.height, cfg.stride });
+
+        std::unique_ptr<Request> request = camera_->createRequest(cookieBase + requests.size());
+
+        // Enable AE + AWB
+        request->controls().set(controls::AeEnable, true);
+        request->controls().set(controls::AwbEnable, true);
+        
+        // CRITICAL: Set crop to full sensor on EVERY request
+        // if (pixelArrayOpt) {
+        //     request->controls().set(controls::ScalerCrop, fullSensorCrop);
+        // }
+
+        request->addBuffer(stream, buffer.get());
+        requests.push_back(std::move(request));
+    }
+
+    return mapped;
+}
+
 LibCameraCapture::~LibCameraCapture() {
     running_ = false;
-    
+    // Frames still held keep their mapping, but are not requeued anymore
+    ring_->stop();
+    if (fullRing_)
+        fullRing_->stop();
+    {
+        std::lock_guard<std::mutex> lock(fullMutex_);
+    }
+    fullCv_.notify_all();
+
     auto start = std::chrono::steady_clock::now();
     while (pendingRequests_ > 0) {
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
@@ -102,74 +198,74 @@ LibCameraCapture::~LibCameraCapture() {
 }
 
 void LibCameraCapture::requestComplete(Request *request) {
+    pendingRequests_--;
+
+    if (!running_)
+        return;
+
+    uint64_t cookie = request->cookie();
     if (request->status() != Request::RequestComplete) {
-        pendingRequests_--;
+        // No frame in the buffer: hand it straight back, so a transient error doesn't
+        // take a buffer out of the ring. An on-demand capture is retried a few times,
+        // then captureFull() is woken up empty handed.
+        if (cookie >= FULL_COOKIE) {
+            if (fullRetries_++ < MAX_FULL_RETRIES) {
+                request->reuse(Request::ReuseBuffers);
+                pendingRequests_++;
+                camera_->queueRequest(request);
+            } else {
+                fullRing_->fail(cookie - FULL_COOKIE);
+            }
+        } else {
+            ring_->drop(cookie);
+        }
         return;
     }
 
-    const FrameBuffer *buffer = request->buffers().begin()->second;
-    // const FrameMetadata &metadata = buffer->metadata();
-    const libcamera::StreamConfiguration &cfg = stream_->configuration();
+    // The ring requeues the buffer once it is superseded or its views are released
+    if (cookie >= FULL_COOKIE)
+        fullRing_->complete(cookie - FULL_COOKIE);
+    else
+        ring_->complete(cookie);
+}
 
-    const FrameBuffer::Plane &plane = buffer->planes()[0];
-    void *data = mmap(nullptr, plane.length, PROT_READ | PROT_WRITE,
-                      MAP_SHARED, plane.fd.get(), 0);
+cv::Mat LibCameraCapture::capture() {
+    return ring_->acquire();
+}
 
-    if (data == MAP_FAILED)
-        return;
+cv::Size LibCameraCapture::frameSize() const {
+    const Size &size = stream_->configuration().size;
+    return cv::Size(size.width, size.height);
+}
 
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        
-        // lastFrame_ = cv::Mat(
-        //     cfg.size.height,
-        //     cfg.size.width,
-        //     CV_8UC3,
-        //     data
-        // ).clone();
-
-        // RGB888 - simple copy with stride
-        size_t stride = cfg.stride;
-        lastFrame_ = cv::Mat(cfg.size.height, cfg.size.width, CV_8UC3);
-        
-        uint8_t* src = static_cast<uint8_t*>(data);
-        for (int y = 0; y < cfg.size.height; y++) {
-            memcpy(lastFrame_.ptr(y), src + y * stride, cfg.size.width * 3);
-        }
+cv::Size LibCameraCapture::fullFrameSize() const {
+    if (!fullStream_)
+        return cv::Size();
+    const Size &size = fullStream_->configuration().size;
+    return cv::Size(size.width, size.height);
+}
 
-        frameReady_ = true;
-    }
+cv::Mat LibCameraCapture::captureFull() {
+    if (!fullStream_)
+        return cv::Mat();
 
-    munmap(data, plane.length);
-    cv_.notify_one();
+    std::lock_guard<std::mutex> captureLock(fullCaptureMutex_);
 
-    if (running_) {
-        request->reuse(Request::ReuseBuffers);
-        camera_->queueRequest(request);
-    } else {
-        pendingRequests_--;
+    size_t index;
+    {
+        std::unique_lock<std::mutex> lock(fullMutex_);
+        fullCv_.wait(lock, [this] { return !freeFull_.empty() || !running_; });
+        if (!running_)
+            return cv::Mat();
+        index = freeFull_.front();
+        freeFull_.pop_front();
     }
-}
 
-cv::Mat LibCameraCapture::capture() {
-    // static int skip = 5;
-    // if (skip-- > 0)
-    //     return cv::Mat();
-
-    std::unique_lock<std::mutex> lock(mutex_);
-    cv_.wait(lock, [&]{ return frameReady_; });
-    frameReady_ = false;
-    // return lastFrame_.clone();
-
-    cv::Mat frame = lastFrame_.clone();
-    
-    // Downscale if needed
-    // if (targetWidth_ > 0 && targetHeight_ > 0 && 
-    //     (frame.cols != targetWidth_ || frame.rows != targetHeight_)) {
-    //     cv::Mat resized;
-    //     cv::resize(frame, resized, cv::Size(targetWidth_, targetHeight_), 0, 0, cv::INTER_LINEAR);
-    //     return resized;
-    // }
-    
-    return frame;
+    Request *request = fullRequests_[index].get();
+    request->reuse(Request::ReuseBuffers);
+    fullRetries_ = 0;
+    pendingRequests_++;
+    camera_->queueRequest(request);
+
+    return fullRing_->acquire();
 }
@@ -2,33 +2,70 @@
 
 #include <libcamera/libcamera.h>
 #include <opencv2/opencv.hpp>
+#include "FrameRing.h"
 #include <memory>
 #include <vector>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 
+// Stream role of the processing stream, picks the camera tuning and sensor mode
+enum class CaptureRole {
+    STILL,
+    VIDEO,
+    VIEWFINDER
+};
+
 class LibCameraCapture {
 public:
-    LibCameraCapture(int width = 1280, int height = 720);
+    // width x height: processing stream, scaled by the ISP (0 = camera default).
+    // fullStream: also a full resolution stream, only captured on demand; it fixes
+    // the sensor mode, so both streams share the same field of view.
+    LibCameraCapture(int width = 0, int height = 0,
+                     CaptureRole role = CaptureRole::STILL,
+                     bool fullStream = false, int fullWidth = 0, int fullHeight = 0);
     ~LibCameraCapture();
 
+    // Read-only view of the newest frame, mapped straight from the camera buffer.
+    // The buffer goes back to the camera once every copy of the view is released,
+    // so clone() frames that are kept for long.
     cv::Mat capture();
 
+    // Read-only view of a frame from the full resolution stream, queued on demand.
+    // Empty if no full resolution stream was configured, or the request kept failing.
+    cv::Mat captureFull();
+
+    // Sizes after validation, the camera may adjust the requested ones
+    cv::Size frameSize() const;
+    cv::Size fullFrameSize() const;
+
+    bool hasFullStream() const { return fullStream_ != nullptr; }
+    uint64_t droppedFrames() const { return ring_->dropped(); }
+
 private:
     void requestComplete(libcamera::Request *request);
+    std::vector<FrameRing::Buffer> createRequests(libcamera::Stream *stream, uint64_t cookieBase,
+                                                  std::vector<std::unique_ptr<libcamera::Request>> &requests);
 
     std::unique_ptr<libcamera::CameraManager> cameraManager_;
     std::shared_ptr<libcamera::Camera> camera_;
     libcamera::Stream *stream_;
+    libcamera::Stream *fullStream_ = nullptr;
     std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
 
     std::vector<std::unique_ptr<libcamera::Request>> requests_;
+    std::vector<std::unique_ptr<libcamera::Request>> fullRequests_;
+
+    std::shared_ptr<FrameRing> ring_;     // Buffers by request cookie
+    std::shared_ptr<FrameRing> fullRing_;
 
-    cv::Mat lastFrame_;
-    std::mutex mutex_;
-    std::condition_variable cv_;
-    bool frameReady_ = false;
+    // Full resolution buffers not queued nor held
+    std::mutex fullMutex_;
+    std::condition_variable fullCv_;
+    std::deque<size_t> freeFull_;
+    std::mutex fullCaptureMutex_;         // One on-demand capture at a time
+    std::atomic<int> fullRetries_{0};     // Of the on-demand capture in flight
 
     int targetWidth_;
     int targetHeight_;
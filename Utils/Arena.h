@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Utils {
+
+/**
+ * Bump allocator for objects of a single type
+ * Objects are constructed in large blocks and destroyed all at once by clear(),
+ * the blocks are kept and reused so a recycled arena stops allocating.
+ *
+ * Example usage:
+ *   Arena<Node> arena(1024);
+ *   arena.reserve(n);                    // next n objects are contiguous
+ *   Node* first = arena.create(args...);
+ *   arena.clear();                       // destroys every node, keeps the memory
+ */
+template<typename T>
+class Arena {
+public:
+    /**
+     * @param block_size Number of objects per block
+     */
+    explicit Arena(size_t block_size = 1024) : block_size_(block_size ? block_size : 1) {}
+
+    ~Arena() {
+        release();
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * Construct a new object in the arena
+     * @return Pointer stable until clear()
+     */
+    template<typename... Args>
+    T* create(Args&&... args) {
+        reserve(1);
+        Block& block = blocks_[current_];
+        T* obj = new (block.data + block.used) T(std::forward<Args>(args)...);
+        block.used++;
+        size_++;
+        return obj;
+    }
+
+    /**
+     * Guarantee the next n objects are placed contiguously
+     * @param n Number of objects
+     */
+    void reserve(size_t n) {
+        while (current_ < blocks_.size() && blocks_[current_].capacity - blocks_[current_].used < n) {
+            current_++;
+        }
+        if (current_ == blocks_.size()) {
+            size_t capacity = n > block_size_ ? n : block_size_;
+            blocks_.push_back({static_cast<T*>(::operator new(capacity * sizeof(T))), capacity, 0});
+            allocations_++;
+        }
+    }
+
+    /**
+     * Destroy every object, keeping the blocks for reuse
+     */
+    void clear() {
+        for (size_t i = 0; i <= current_ && i < blocks_.size(); i++) {
+            Block& block = blocks_[i];
+            for (size_t j = 0; j < block.used; j++) block.data[j].~T();
+            block.used = 0;
+        }
+        current_ = 0;
+        size_ = 0;
+    }
+
+    /**
+     * Destroy every object and return the blocks to the system
+     */
+    void release() {
+        clear();
+        for (Block& block : blocks_) ::operator delete(block.data);
+        blocks_.clear();
+    }
+
+    /**
+     * @return Number of live objects
+     */
+    size_t size() const {
+        return size_;
+    }
+
+    /**
+     * @return Number of blocks requested from the system over the arena lifetime
+     */
+    size_t allocations() const {
+        return allocations_;
+    }
+
+private:
+    struct Block {
+        T* data;
+        size_t capacity;
+        size_t used;
+    };
+
+    std::vector<Block> blocks_;
+    size_t block_size_;
+    size_t current_ = 0;
+    size_t size_ = 0;
+    size_t allocations_ = 0;
+};
+
+/**
+ * Fixed size object pool with a free list
+ * For objects with individual lifetimes: destroyed slots are reused by the next create().
+ */
+template<typename T>
+class Pool {
+public:
+    /**
+     * @param block_size Number of objects per block
+     */
+    explicit Pool(size_t block_size = 1024) : block_size_(block_size ? block_size : 1) {}
+
+    /**
+     * Frees the blocks; live objects are not destroyed, the owner has to destroy them first
+     */
+    ~Pool() {
+        for (Slot* block : blocks_) ::operator delete(block);
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+        if (free_ == nullptr) grow();
+        Slot* slot = free_;
+        free_ = slot->next;
+        T* obj = new (slot->storage) T(std::forward<Args>(args)...);
+        size_++;
+        return obj;
+    }
+
+    void destroy(T* obj) {
+        obj->~T();
+        Slot* slot = reinterpret_cast<Slot*>(obj);
+        slot->next = free_;
+        free_ = slot;
+        size_--;
+    }
+
+    /**
+     * @return Number of live objects
+     */
+    size_t size() const {
+        return size_;
+    }
+
+    /**
+     * @return Number of blocks requested from the system over the pool lifetime
+     */
+    size_t allocations() const {
+        return blocks_.size();
+    }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    void grow() {
+        Slot* block = static_cast<Slot*>(::operator new(block_size_ * sizeof(Slot)));
+        for (size_t i = 0; i < block_size_; i++) {
+            block[i].next = (i + 1 < block_size_) ? &block[i + 1] : free_;
+        }
+        free_ = block;
+        blocks_.push_back(block);
+    }
+
+    std::vector<Slot*> blocks_;
+    Slot* free_ = nullptr;
+    size_t block_size_;
+    size_t size_ = 0;
+};
+
+} // namespace Utils
@@ -0,0 +1,70 @@
+#include "AsyncPublisher.h"
+
+namespace Utils {
+
+AsyncPublisher::AsyncPublisher(Sender sender, size_t capacity, bool coalesce)
+    : sender_(std::move(sender)), capacity_(capacity ? capacity : 1), coalesce_(coalesce) {
+    worker_ = std::thread(&AsyncPublisher::worker_loop, this);
+}
+
+AsyncPublisher::~AsyncPublisher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_stopping_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+}
+
+void AsyncPublisher::publish(const std::string& message) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.size() >= capacity_) {
+            queue_.pop_front();
+            stats_.dropped++;
+        }
+        queue_.emplace_back(message, Clock::now());
+    }
+    cv_.notify_one();
+}
+
+AsyncPublisher::Stats AsyncPublisher::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void AsyncPublisher::worker_loop() {
+    while (true) {
+        std::pair<std::string, Clock::time_point> item;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return is_stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return; // stopping and drained
+
+            if (coalesce_) {
+                stats_.dropped += queue_.size() - 1;
+                item = std::move(queue_.back());
+                queue_.clear();
+            } else {
+                item = std::move(queue_.front());
+                queue_.pop_front();
+            }
+        }
+
+        bool is_ok = false;
+        try {
+            is_ok = sender_(item.first);
+        } catch (...) {
+            is_ok = false;
+        }
+        double latency = std::chrono::duration<double>(Clock::now() - item.second).count();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.published++;
+        if (!is_ok) stats_.failed++;
+        stats_.total_latency += latency;
+        if (latency > stats_.max_latency) stats_.max_latency = latency;
+    }
+}
+
+} // namespace Utils
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace Utils {
+
+/**
+ * Sends messages from a dedicated thread so the caller never waits on the sender
+ * The queue is bounded: when it is full the oldest message is dropped. With coalescing,
+ * a backlog is collapsed to its latest message, which is all a state update needs.
+ *
+ * Example usage:
+ *   AsyncPublisher publisher([](const std::string& msg) { return send(msg); });
+ *   publisher.publish(fen);              // returns immediately
+ */
+class AsyncPublisher {
+public:
+    /**
+     * @param message Message to deliver
+     * @return false if delivery failed
+     */
+    using Sender = std::function<bool(const std::string& message)>;
+
+    struct Stats {
+        uint64_t published = 0;     // messages handed to the sender
+        uint64_t failed = 0;        // messages the sender failed to deliver
+        uint64_t dropped = 0;       // messages replaced by a newer one before being sent
+        double total_latency = 0.0; // seconds from publish() to the sender returning, over published messages
+        double max_latency = 0.0;
+    };
+
+    /**
+     * @param sender Called on the publisher thread only
+     * @param capacity Maximum number of queued messages
+     * @param coalesce Send only the latest queued message when backlogged
+     */
+    explicit AsyncPublisher(Sender sender, size_t capacity = 16, bool coalesce = true);
+
+    /**
+     * Delivers what is still queued (only the latest when coalescing), then joins the thread
+     */
+    ~AsyncPublisher();
+
+    AsyncPublisher(const AsyncPublisher&) = delete;
+    AsyncPublisher& operator=(const AsyncPublisher&) = delete;
+
+    /**
+     * Queue a message, never blocks on the sender
+     */
+    void publish(const std::string& message);
+
+    /**
+     * @return Counters so far
+     */
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void worker_loop();
+
+    Sender sender_;
+    size_t capacity_;
+    bool coalesce_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::pair<std::string, Clock::time_point>> queue_;
+    bool is_stopping_ = false;
+    Stats stats_;
+
+    std::thread worker_;
+};
+
+} // namespace Utils
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace Utils {
+
+/**
+ * Blocking FIFO with a fixed capacity, connecting the stages of a pipeline
+ * push() waits while the queue is full, pop() while it is empty. Once closed, pushes
+ * are refused and pops drain what is left, then fail.
+ *
+ * Example usage:
+ *   BoundedQueue<Frame> queue(2);
+ *   queue.push(std::move(frame));        // producer
+ *   while (queue.pop(frame)) { ... }     // consumer, ends after close()
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    /**
+     * @param capacity Maximum number of queued items
+     */
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+     * @return false if the queue was closed, the item is dropped
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return is_closed_ || items_.size() < capacity_; });
+        if (is_closed_) return false;
+        items_.push_back(std::move(item));
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /**
+     * Never waits, for producers that must not stall (e.g. a capture thread)
+     * @return false if the queue is full or closed, the item is dropped
+     */
+    bool try_push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (is_closed_ || items_.size() >= capacity_) return false;
+        items_.push_back(std::move(item));
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /**
+     * @return false once the queue is closed and empty
+     */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return is_closed_ || !items_.empty(); });
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    /**
+     * Wake every waiting thread, no more items are accepted
+     */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    size_t capacity_;
+    bool is_closed_ = false;
+};
+
+} // namespace Utils
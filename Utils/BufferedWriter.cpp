@@ -0,0 +1,70 @@
+#include "BufferedWriter.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Utils {
+
+BufferedWriter::BufferedWriter(const std::string& path, size_t flush_bytes, double flush_interval)
+    : flush_bytes_(flush_bytes), flush_interval_(flush_interval), last_flush_(std::chrono::steady_clock::now()) {
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    buffer_.reserve(flush_bytes_);
+}
+
+BufferedWriter::~BufferedWriter() {
+    flush(true);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+bool BufferedWriter::is_open() const {
+    return fd_ >= 0;
+}
+
+uint64_t BufferedWriter::errors() const {
+    return errors_;
+}
+
+void BufferedWriter::write(const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    buffer_.insert(buffer_.end(), bytes, bytes + size);
+    flush_if_due();
+}
+
+void BufferedWriter::write_line(const std::string& line) {
+    buffer_.insert(buffer_.end(), line.begin(), line.end());
+    buffer_.push_back('\n');
+    flush_if_due();
+}
+
+void BufferedWriter::flush_if_due() {
+    if (buffer_.empty()) return;
+    if (buffer_.size() >= flush_bytes_ || std::chrono::steady_clock::now() - last_flush_ >= flush_interval_) {
+        flush();
+    }
+}
+
+void BufferedWriter::flush(bool is_durable) {
+    last_flush_ = std::chrono::steady_clock::now();
+    if (fd_ < 0) {
+        if (!buffer_.empty()) errors_++; // the file never opened, this data is lost
+        buffer_.clear();
+        return;
+    }
+
+    size_t written = 0;
+    while (written < buffer_.size()) {
+        ssize_t res = ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            errors_++; // nothing more can be done for this data, reported by errors()
+            break;
+        }
+        written += (size_t)res;
+    }
+    buffer_.clear();
+
+    if (is_durable && ::fsync(fd_) != 0) errors_++;
+}
+
+} // namespace Utils
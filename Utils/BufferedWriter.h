@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Utils {
+
+/**
+ * Append-only file kept open for its whole lifetime, written through a memory buffer
+ * The buffer goes to the file once it holds flush_bytes or when flush_interval has passed
+ * since the last flush; flush(true) also syncs it to the storage device.
+ *
+ * Example usage:
+ *   BufferedWriter log("game_fens.csv");
+ *   log.write_line(fen);
+ *   log.flush(true);                     // on shutdown, survives power loss
+ */
+class BufferedWriter {
+public:
+    /**
+     * @param path File to append to, created if missing
+     * @param flush_bytes Buffered size that triggers a flush
+     * @param flush_interval Seconds after which buffered data is flushed
+     */
+    explicit BufferedWriter(const std::string& path, size_t flush_bytes = 64 * 1024, double flush_interval = 5.0);
+
+    /**
+     * Flushes durably and closes the file
+     */
+    ~BufferedWriter();
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    /**
+     * @return true if the file could be opened
+     */
+    bool is_open() const;
+
+    /**
+     * @return Failed writes and syncs so far (including flushes while the file is not open);
+     * the data of a failed write is lost
+     */
+    uint64_t errors() const;
+
+    void write(const void* data, size_t size);
+    void write_line(const std::string& line);
+
+    /**
+     * Flush if the size or time threshold is reached
+     */
+    void flush_if_due();
+
+    /**
+     * Write the buffer to the file
+     * @param is_durable Also wait for the data to reach the storage device
+     */
+    void flush(bool is_durable = false);
+
+private:
+    int fd_ = -1;
+    uint64_t errors_ = 0;
+    std::vector<char> buffer_;
+    size_t flush_bytes_;
+    std::chrono::duration<double> flush_interval_;
+    std::chrono::steady_clock::time_point last_flush_;
+};
+
+} // namespace Utils
@@ -0,0 +1,222 @@
+#include "SessionFile.h"
+#include "SharedMat.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Utils {
+
+static const char SESSION_MAGIC[8] = {'C', 'L', 'S', 'E', 'S', 'S', '0', '1'};
+static const uint32_t SESSION_VERSION = 1;
+
+static size_t aligned(size_t size) {
+    return (size + SESSION_ALIGN - 1) / SESSION_ALIGN * SESSION_ALIGN;
+}
+
+// ============================================================================
+// SessionWriter
+// ============================================================================
+
+static bool is_complete_frame(const SessionFrameHeader& header, size_t offset, size_t file_size) {
+    return header.rows > 0 && header.cols > 0 &&
+           header.data_size == (uint64_t)header.rows * header.cols * CV_ELEM_SIZE(header.type) &&
+           offset + sizeof(SessionFrameHeader) + header.data_size <= file_size;
+}
+
+/**
+ * Check an existing session before appending to it, and cut a frame left short by a
+ * crash: the reader stops at the first incomplete frame, so anything appended after it
+ * would be lost
+ * @param last Set to the header of the last complete frame (rows = 0 if there is none)
+ * @return true if there is no session yet and the file header must be written
+ * @throws std::runtime_error if the file is not a session of this version
+ */
+static bool prepare_append(const std::string& path, SessionFrameHeader& last) {
+    last = SessionFrameHeader{};
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return true;    // Missing, or reported by is_open() once BufferedWriter fails to open it
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to stat session: " + path);
+    }
+    size_t file_size = st.st_size;
+    if (file_size == 0) {
+        ::close(fd);
+        return true;
+    }
+
+    SessionFileHeader file_header;
+    if (file_size < sizeof(file_header) ||
+        ::pread(fd, &file_header, sizeof(file_header), 0) != (ssize_t)sizeof(file_header) ||
+        std::memcmp(file_header.magic, SESSION_MAGIC, sizeof(SESSION_MAGIC)) != 0 ||
+        file_header.version != SESSION_VERSION) {
+        ::close(fd);
+        throw std::runtime_error("Not a session file, refusing to append: " + path);
+    }
+
+    // Walk the chain of frame headers up to the first incomplete frame
+    size_t offset = sizeof(SessionFileHeader);
+    SessionFrameHeader header;
+    while (offset + sizeof(header) <= file_size &&
+           ::pread(fd, &header, sizeof(header), offset) == (ssize_t)sizeof(header) &&
+           is_complete_frame(header, offset, file_size)) {
+        last = header;
+        offset += sizeof(header) + aligned(header.data_size);
+    }
+
+    // Also restores the padding of a last frame cut right after its pixels
+    if (offset != file_size && ::ftruncate(fd, offset) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to truncate session: " + path);
+    }
+    ::close(fd);
+    return false;
+}
+
+SessionWriter::SessionWriter(const std::string& path) {
+    SessionFrameHeader last;
+    bool is_new = prepare_append(path, last);
+    rows_ = last.rows;
+    cols_ = last.cols;
+    type_ = last.type;
+
+    // Large buffer: frames are hundreds of kilobytes each
+    writer_ = std::make_unique<BufferedWriter>(path, 4 * 1024 * 1024);
+    if (is_new && writer_->is_open()) {
+        SessionFileHeader header{};
+        std::memcpy(header.magic, SESSION_MAGIC, sizeof(header.magic));
+        header.version = SESSION_VERSION;
+        writer_->write(&header, sizeof(header));
+    }
+}
+
+bool SessionWriter::is_open() const {
+    return writer_->is_open();
+}
+
+bool SessionWriter::write(const cv::Mat& frame, int64_t timestamp_us) {
+    static const char padding[SESSION_ALIGN] = {};
+
+    // Frames of a session share one geometry, set by the first frame ever written
+    if (rows_ == 0) {
+        rows_ = frame.rows;
+        cols_ = frame.cols;
+        type_ = frame.type();
+    } else if (frame.rows != rows_ || frame.cols != cols_ || frame.type() != type_) {
+        return false;
+    }
+
+    size_t row_size = frame.cols * frame.elemSize();
+    SessionFrameHeader header{};
+    header.timestamp_us = timestamp_us;
+    header.rows = frame.rows;
+    header.cols = frame.cols;
+    header.type = frame.type();
+    header.data_size = row_size * frame.rows;
+    header.flags = is_run_start_ ? SESSION_RUN_START : 0;
+    is_run_start_ = false;
+    writer_->write(&header, sizeof(header));
+
+    // Camera views have a stride, rows are stored packed
+    if (frame.isContinuous()) {
+        writer_->write(frame.data, header.data_size);
+    } else {
+        for (int y = 0; y < frame.rows; y++)
+            writer_->write(frame.ptr(y), row_size);
+    }
+    writer_->write(padding, aligned(header.data_size) - header.data_size);
+    return true;
+}
+
+void SessionWriter::flush(bool is_durable) {
+    writer_->flush(is_durable);
+}
+
+// ============================================================================
+// SessionReader
+// ============================================================================
+
+struct SessionReader::Mapping {
+    uint8_t* data = nullptr;
+    size_t size = 0;
+
+    ~Mapping() {
+        if (data) ::munmap(data, size);
+    }
+};
+
+SessionReader::SessionReader(const std::string& path) : mapping_(std::make_shared<Mapping>()) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open session: " + path);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SessionFileHeader)) {
+        ::close(fd);
+        throw std::runtime_error("Invalid session: " + path);
+    }
+
+    void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        throw std::runtime_error("Failed to map session: " + path);
+    mapping_->data = static_cast<uint8_t*>(data);
+    mapping_->size = st.st_size;
+
+    // Frames are read in order once
+    ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    const SessionFileHeader* file_header = reinterpret_cast<const SessionFileHeader*>(mapping_->data);
+    if (std::memcmp(file_header->magic, SESSION_MAGIC, sizeof(SESSION_MAGIC)) != 0 ||
+        file_header->version != SESSION_VERSION)
+        throw std::runtime_error("Invalid session: " + path);
+
+    // Index of complete frames, a truncated last frame is left out
+    size_t offset = sizeof(SessionFileHeader);
+    while (offset + sizeof(SessionFrameHeader) <= mapping_->size) {
+        const SessionFrameHeader* header = reinterpret_cast<const SessionFrameHeader*>(mapping_->data + offset);
+        if (!is_complete_frame(*header, offset, mapping_->size))
+            break;
+        offsets_.push_back(offset);
+        offset = offset + sizeof(SessionFrameHeader) + aligned(header->data_size);
+    }
+
+    // One timeline across runs: a run starts one frame interval after the previous run's end
+    int64_t shift = 0;
+    timestamps_.reserve(offsets_.size());
+    for (size_t i = 0; i < offsets_.size(); i++) {
+        const SessionFrameHeader* header = reinterpret_cast<const SessionFrameHeader*>(mapping_->data + offsets_[i]);
+        if (i > 0 && (header->flags & SESSION_RUN_START)) {
+            int64_t interval = i > 1 ? std::max<int64_t>(0, timestamps_[i - 1] - timestamps_[i - 2]) : 0;
+            shift = timestamps_[i - 1] + interval - header->timestamp_us;
+        }
+        timestamps_.push_back(header->timestamp_us + shift);
+    }
+}
+
+size_t SessionReader::size() const {
+    return offsets_.size();
+}
+
+cv::Mat SessionReader::frame(size_t index) const {
+    const uint8_t* base = mapping_->data + offsets_.at(index);
+    const SessionFrameHeader* header = reinterpret_cast<const SessionFrameHeader*>(base);
+    void* pixels = const_cast<uint8_t*>(base + sizeof(SessionFrameHeader));
+    size_t step = header->data_size / header->rows;
+    return shared_mat(header->rows, header->cols, header->type, pixels, step, mapping_);
+}
+
+int64_t SessionReader::timestamp_us(size_t index) const {
+    return timestamps_.at(index);
+}
+
+} // namespace Utils
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BufferedWriter.h"
+
+namespace Utils {
+
+/**
+ * Recorded session: one append-only file of raw frames, each with its capture time
+ *
+ * Layout, every block aligned to SESSION_ALIGN bytes so frames can be used in place:
+ *   SessionFileHeader
+ *   SessionFrameHeader, pixel rows (cols * elemSize bytes each), padding   (per frame)
+ * The index of capture times is the chain of frame headers, rebuilt when the file is
+ * opened; a frame cut short by a crash is ignored, and cut off before appending.
+ * All frames of a session have the same rows, cols and type.
+ *
+ * A session can span several recording runs (one per SessionWriter). Capture times are
+ * steady clock, which has no epoch shared across runs or reboots, so the first frame of
+ * each run is flagged and the reader puts every run right after the previous one.
+ */
+constexpr size_t SESSION_ALIGN = 64;
+
+// SessionFrameHeader::flags
+constexpr uint32_t SESSION_RUN_START = 1;   // First frame of a recording run
+
+#pragma pack(push, 1)
+struct SessionFileHeader {
+    char magic[8];              // "CLSESS01"
+    uint32_t version;
+    uint8_t reserved[SESSION_ALIGN - 12];
+};
+
+struct SessionFrameHeader {
+    int64_t timestamp_us;       // Capture time, steady clock microseconds of its run
+    int32_t rows;
+    int32_t cols;
+    int32_t type;               // OpenCV type, e.g. CV_8UC3
+    uint32_t flags;             // SESSION_RUN_START, 0 in sessions written before runs were flagged
+    uint64_t data_size;         // Pixel bytes, without padding
+    uint8_t reserved[SESSION_ALIGN - 32];
+};
+#pragma pack(pop)
+
+/**
+ * Appends frames to a session file
+ *
+ * Example usage:
+ *   SessionWriter writer("game.session");
+ *   writer.write(img, capture_time_us);
+ */
+class SessionWriter {
+public:
+    /**
+     * @param path Session file, created with its header if missing, appended to otherwise
+     * (after its complete frames, a frame cut short by a crash is truncated)
+     * @throws std::runtime_error if the existing file is not a session of this version
+     */
+    explicit SessionWriter(const std::string& path);
+
+    SessionWriter(const SessionWriter&) = delete;
+    SessionWriter& operator=(const SessionWriter&) = delete;
+
+    bool is_open() const;
+
+    /**
+     * @return false, writing nothing, if frame doesn't have the geometry of the session
+     */
+    bool write(const cv::Mat& frame, int64_t timestamp_us);
+
+    /**
+     * @param is_durable Also wait for the data to reach the storage device
+     */
+    void flush(bool is_durable = false);
+
+private:
+    std::unique_ptr<BufferedWriter> writer_;
+    int rows_ = 0;      // Geometry of the session, rows_ = 0 until the first frame
+    int cols_ = 0;
+    int type_ = 0;
+    bool is_run_start_ = true;  // Next frame is the first one of this run
+};
+
+/**
+ * Read-only, memory-mapped session file
+ * Frames are served in place as read-only Mats; the mapping stays valid as long as the
+ * reader or any frame taken from it is alive.
+ *
+ * Example usage:
+ *   SessionReader reader("game.session");
+ *   for (size_t i = 0; i < reader.size(); i++) process(reader.frame(i));
+ */
+class SessionReader {
+public:
+    /**
+     * @throws std::runtime_error if the file cannot be mapped or is not a session
+     */
+    explicit SessionReader(const std::string& path);
+
+    SessionReader(const SessionReader&) = delete;
+    SessionReader& operator=(const SessionReader&) = delete;
+
+    size_t size() const;
+
+    cv::Mat frame(size_t index) const;
+
+    /**
+     * @return Capture time of frame index on the session's timeline, microseconds: the first
+     * run keeps its steady clock times, each later run continues from the previous run's last
+     * frame, one frame interval (the last one before it) later
+     */
+    int64_t timestamp_us(size_t index) const;
+
+private:
+    struct Mapping;
+
+    std::shared_ptr<Mapping> mapping_;
+    std::vector<size_t> offsets_;       // Frame header of every complete frame
+    std::vector<int64_t> timestamps_;   // Session timeline, see timestamp_us
+};
+
+} // namespace Utils
@@ -0,0 +1,50 @@
+#include "SharedMat.h"
+
+namespace Utils {
+
+namespace {
+
+/**
+ * Allocator of the UMatData of shared mats: OpenCV hands it back here once the last
+ * Mat referencing it is released, and the owner is dropped instead of freeing data
+ */
+class OwnerAllocator : public cv::MatAllocator {
+public:
+    static OwnerAllocator& instance() {
+        static OwnerAllocator allocator;
+        return allocator;
+    }
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, accessflags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        if (!u) return;
+        delete static_cast<std::shared_ptr<void>*>(u->userdata);
+        delete u;
+    }
+};
+
+} // namespace
+
+cv::Mat shared_mat(int rows, int cols, int type, void* data, size_t step, std::shared_ptr<void> owner) {
+    cv::Mat view(rows, cols, type, data, step);
+
+    cv::UMatData* u = new cv::UMatData(&OwnerAllocator::instance());
+    u->data = u->origdata = static_cast<uchar*>(data);
+    u->size = step * rows;
+    u->flags |= cv::UMatData::USER_ALLOCATED;
+    u->userdata = new std::shared_ptr<void>(std::move(owner));
+    view.u = u;
+    view.addref();
+
+    return view;
+}
+
+} // namespace Utils
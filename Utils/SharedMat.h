@@ -0,0 +1,20 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <memory>
+
+namespace Utils {
+
+/**
+ * cv::Mat over memory it does not own (camera buffers, mapped files), without copying
+ * The Mat and all its copies and ROIs share owner, which is released with the last of
+ * them, exactly like the refcount of an allocated Mat.
+ *
+ * Example usage:
+ *   auto mapping = std::make_shared<Mapping>(path);
+ *   cv::Mat view = shared_mat(rows, cols, CV_8UC3, mapping->data, step, mapping);
+ */
+cv::Mat shared_mat(int rows, int cols, int type, void* data, size_t step, std::shared_ptr<void> owner);
+
+} // namespace Utils
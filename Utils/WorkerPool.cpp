@@ -0,0 +1,83 @@
+#include "WorkerPool.h"
+
+namespace Utils {
+
+WorkerPool::WorkerPool(int n_threads) {
+    for (int i = 1; i < n_threads; i++) {
+        workers_.emplace_back(&WorkerPool::worker_loop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_stopping_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto& worker : workers_) worker.join();
+}
+
+int WorkerPool::size() const {
+    return (int)workers_.size() + 1;
+}
+
+void WorkerPool::parallel_for(size_t n, const std::function<void(size_t)>& task) {
+    if (n == 0) return;
+
+    if (workers_.empty() || n == 1) {
+        for (size_t i = 0; i < n; i++) task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        n_tasks_ = n;
+        next_task_ = 0;
+        error_ = nullptr;
+        active_workers_ = (int)workers_.size();
+        generation_++;
+    }
+    start_cv_.notify_all();
+
+    run_tasks();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return active_workers_ == 0; });
+    task_ = nullptr;
+
+    if (error_) std::rethrow_exception(error_);
+}
+
+void WorkerPool::worker_loop() {
+    uint64_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_cv_.wait(lock, [&] { return is_stopping_ || generation_ != seen_generation; });
+            if (is_stopping_) return;
+            seen_generation = generation_;
+        }
+
+        run_tasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_workers_--;
+        }
+        done_cv_.notify_one();
+    }
+}
+
+void WorkerPool::run_tasks() {
+    for (size_t i = next_task_++; i < n_tasks_; i = next_task_++) {
+        try {
+            (*task_)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) error_ = std::current_exception();
+        }
+    }
+}
+
+} // namespace Utils
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Utils {
+
+/**
+ * Fixed set of worker threads for data parallel loops
+ * The calling thread takes part in every loop, so a pool of size 1 runs everything inline.
+ *
+ * Example usage:
+ *   WorkerPool pool(4);
+ *   pool.parallel_for(items.size(), [&](size_t i) { process(items[i]); });
+ */
+class WorkerPool {
+public:
+    /**
+     * @param n_threads Total threads working on a loop, including the caller
+     */
+    explicit WorkerPool(int n_threads);
+
+    /**
+     * Stops and joins the workers
+     */
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * Run task(i) for every i in [0, n), indices are handed out dynamically
+     * Blocks until all are done; the first exception thrown by a task is rethrown here.
+     */
+    void parallel_for(size_t n, const std::function<void(size_t)>& task);
+
+    /**
+     * @return Number of threads working on a loop, including the caller
+     */
+    int size() const;
+
+private:
+    void worker_loop();
+    void run_tasks();
+
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    uint64_t generation_ = 0;
+    int active_workers_ = 0;
+    bool is_stopping_ = false;
+
+    // current loop
+    const std::function<void(size_t)>* task_ = nullptr;
+    size_t n_tasks_ = 0;
+    std::atomic<size_t> next_task_{0};
+    std::exception_ptr error_;
+};
+
+} // namespace Utils
@@ -1,5 +1,6 @@
 #include "ChessLens.h"
 #include "Utils/ChessUtils.h"
+#include "Utils/AsyncPublisher.h"
 
 #include <iostream>
 #include <fstream>
@@ -29,28 +30,40 @@ void signal_handler(int signal) {
     }
 }
 
+#ifdef USE_HTTP
+// Reused by every update so the connection to the receiver is kept alive
+CURL* fen_curl = nullptr;
+#endif
+
 /**
  * Update FEN via HTTP request
  * Requires libcurl or similar HTTP library
+ * Runs on the FEN publisher thread, never on the frame loop
  */
-void update_fen(const std::string& fen) {
+bool update_fen(const std::string& fen) {
 #ifdef USE_HTTP
-    CURL* curl = curl_easy_init();
-    if (curl) {
-        std::string url = "http://10.42.0.1:8000/update_fen?fen=" + fen;
-        // std::string url = "http://localhost:8000/update_fen?fen=" + fen;
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L); // HEAD request
-        CURLcode res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            std::cerr << "curl_easy_perform() failed: " 
-                      << curl_easy_strerror(res) << std::endl;
-        }
-        curl_easy_cleanup(curl);
+    if (!fen_curl) {
+        fen_curl = curl_easy_init();
+        if (!fen_curl) return false;
+        curl_easy_setopt(fen_curl, CURLOPT_NOBODY, 1L); // HEAD request
+        curl_easy_setopt(fen_curl, CURLOPT_CONNECTTIMEOUT_MS, 1000L);
+        curl_easy_setopt(fen_curl, CURLOPT_TIMEOUT_MS, 2000L);
     }
+    
+    std::string url = "http://10.42.0.1:8000/update_fen?fen=" + fen;
+    // std::string url = "http://localhost:8000/update_fen?fen=" + fen;
+    curl_easy_setopt(fen_curl, CURLOPT_URL, url.c_str());
+    CURLcode res = curl_easy_perform(fen_curl);
+    if (res != CURLE_OK) {
+        std::cerr << "curl_easy_perform() failed: " 
+                  << curl_easy_strerror(res) << std::endl;
+        return false;
+    }
+    return true;
 #else
     // HTTP disabled - just print the FEN
     std::cout << "FEN Update: " << fen << std::endl;
+    return true;
 #endif
 }
 
@@ -76,6 +89,7 @@ int main(int argc, char** argv) {
         // Configuration
         std::string algorithm = "cnn_onnx_static";
         std::string dirname = "game_fens";
+        std::string replay_path = "";   // Image directory or session file to replay instead of the camera
         
         // Parse command line arguments (optional)
         if (argc > 1) {
@@ -84,18 +98,27 @@ int main(int argc, char** argv) {
         if (argc > 2) {
             dirname = argv[2];
         }
+        if (argc > 3) {
+            replay_path = argv[3];
+        }
         
         // Model paths - adjust these to your actual paths
         std::string piece_detector_path = "models/" + algorithm + ".onnx";
         std::string occlusion_detector_path = "models/occlusion_detector.onnx";
         
+        // FEN updates are sent from their own thread, backlogs collapse to the latest FEN
+        Utils::AsyncPublisher fen_publisher(update_fen);
+        
         // Configure ChessLens
         ChessLensConfig config;
         config.camera_interval = 0.2;
         config.context_delay = 5.0;  // 5 seconds
         config.context_continuous = true;
+        config.pipelined = true;
+        config.latest_frame_capture = replay_path.empty();  // A replay processes every frame
+        config.replay_path = replay_path;
         config.game_out_path = dirname;
-        config.fen_update = update_fen;
+        config.fen_update = [&fen_publisher](const std::string& fen) { fen_publisher.publish(fen); };
         
         // Create game instances
         std::cout << "Initializing ChessLens...\n";
@@ -111,11 +134,27 @@ int main(int argc, char** argv) {
         // Main processing loop
         std::vector<double> frame_times;
         
+        // Capture, geometry and piece recognition run ahead on their own threads,
+        // this loop is the HMM stage
+        if (config.pipelined) {
+            game1.start_pipeline();
+        }
+        
         while (is_running) {
             auto t1 = std::chrono::high_resolution_clock::now();
             
             // Process frame from camera
-            auto probs = game1.operate();
+            PipelineFrame frame;
+            if (config.pipelined) {
+                if (!game1.next_frame(frame)) {
+                    std::cout << "No more frames.\n";
+                    break;
+                }
+            } else {
+                frame.capture_time = std::chrono::steady_clock::now();
+                frame.probs = game1.operate();
+                frame.is_board_lost = frame.probs.empty() && game1.board_flag.get();
+            }
             auto t2 = std::chrono::high_resolution_clock::now();
             cout << "Game1: " << std::chrono::duration<double>(t2 - t1).count() * 1000 << "\n";
             
@@ -123,18 +162,19 @@ int main(int argc, char** argv) {
             game2.update_bindings();
             
             // Check if we should stop (no more frames)
-            if (!(probs.empty())) {
+            if (!(frame.probs.empty())) {
                 // Process probabilities through context model
-                game2.operate(probs);
+                game2.operate(frame.probs, frame.capture_time);
             } else {
                 // Check if this is end of video/images or just a filtered frame
-                if (game1.board_flag.get()) {
+                if (frame.is_board_lost) {
                     std::cout << "Board detection failed too many times. Stopping.\n";
                     break;
                 }
             }            
             auto t3 = std::chrono::high_resolution_clock::now();
-            cout << "Game2: " << std::chrono::duration<double>(t3 - t2).count() * 1000 << "\n";
+            cout << "Game2: " << std::chrono::duration<double>(t3 - t2).count() * 1000 << " (width " << game2.width() << ")\n";
+            cout << "Latency: " << std::chrono::duration<double>(std::chrono::steady_clock::now() - frame.capture_time).count() * 1000 << "\n";
             
             double frame_time = std::chrono::duration<double>(t3 - t1).count();
             frame_times.push_back(frame_time);
@@ -145,11 +185,15 @@ int main(int argc, char** argv) {
             }
         }
         
+        game1.stop_pipeline();
+        
         std::cout << "\n\nProcessing complete. Finalizing...\n";
         
         // Calculate statistics
         if (frame_times.empty()) {
             std::cout << "No frames were processed.\n";
+            game1.quit();
+            game2.quit();
             return 0;
         }
         
@@ -169,6 +213,7 @@ int main(int argc, char** argv) {
                   << (game1.avg_times.img_capture * 1000.0 / game1.avg_times.img_capture_count) << " ms\t" << game1.avg_times.img_capture_count << "\n";
         std::cout << "Avg Wait Time:      \t" 
                   << (game1.sleep_time() * 1000.0 / game1.avg_times.img_capture_count) << " ms\t" << game1.avg_times.img_capture_count << "\n";
+        std::cout << "Dropped Frames:         " << game1.dropped_frames() << "\n";
         std::cout << "Avg Image Loading:      " 
                   << (game1.avg_times.load * 1000.0 / game1.avg_times.load_count) << " ms\t" << game1.avg_times.load_count << "\n";
         std::cout << "Avg Board Detection:    " 
@@ -181,12 +226,21 @@ int main(int argc, char** argv) {
                   << (game1.avg_times.piece_recognition * 1000.0 / game1.avg_times.piece_count) << " ms\t" << game1.avg_times.piece_count << "\n";
         std::cout << "Avg HMM:                " 
                   << (game2.avg_times.hmm * 1000.0 / game2.avg_times.hmm_count) << " ms\t" << game2.avg_times.hmm_count << "\n";
+        std::cout << "Avg HMM Width:          " 
+                  << (game2.avg_times.hmm_width / game2.avg_times.hmm_count) << "\n";
         std::cout << "\n";
         std::cout << "Avg Frame Time:         " << (avg_frame * 1000.0) << " ms\n";
         std::cout << "Frame Count:            " << frame_count << "\n";
         std::cout << "Total Time:             " << (total_time * 1000.0) << " ms\n";
         std::cout << "FPS:                    " << (frame_count / total_time) << "\n";
         
+        auto fen_stats = fen_publisher.stats();
+        std::cout << "FEN Updates Sent:       " << fen_stats.published 
+                  << " (" << fen_stats.failed << " failed, " << fen_stats.dropped << " dropped)\n";
+        std::cout << "Avg FEN Update Latency: " 
+                  << (fen_stats.published ? fen_stats.total_latency * 1000.0 / fen_stats.published : 0.0) 
+                  << " ms (max " << fen_stats.max_latency * 1000.0 << " ms)\n";
+        
         // Process FENs (remove timestamps if present)
         std::vector<std::string> clean_fens;
         for (const auto& fen : fens) {
@@ -231,13 +285,19 @@ int main(int argc, char** argv) {
         // Cleanup
         game1.quit();
         game2.quit();
+        if (game2.log_errors() > 0) {
+            std::cerr << "Warning: " << game2.log_errors() << " failed writes to the game logs, data was lost\n";
+        }
         
         std::cout << "\nDone!\n";
         
     } catch (const std::exception& e) {
+        // game1 and game2 were destroyed while unwinding: the game logs were
+        // flushed and synced by their BufferedWriter destructors
         std::cerr << "Error: " << e.what() << std::endl;
         
 #ifdef USE_HTTP
+        if (fen_curl) curl_easy_cleanup(fen_curl);
         curl_global_cleanup();
 #endif
         return 1;
@@ -245,6 +305,7 @@ int main(int argc, char** argv) {
     
 #ifdef USE_HTTP
     // Cleanup curl
+    if (fen_curl) curl_easy_cleanup(fen_curl);
     curl_global_cleanup();
 #endif
     
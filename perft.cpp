@@ -0,0 +1,126 @@
+#include "ChessGameState.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+
+/**
+ * Perft benchmark and correctness check for the ChessGameState move generator
+ *
+ * Usage:
+ *   chess_perft [--threads N]                             run the reference suite
+ *   chess_perft --fen "<fen>" --depth N [--expect NODES] [--threads N]
+ *
+ * Exits with 1 when a node count doesn't match the expected one.
+ */
+
+struct PerftCase {
+    std::string name;
+    std::string fen;
+    int depth;
+    uint64_t nodes;
+};
+
+// Reference positions from the chessprogramming wiki perft results page
+static const std::vector<PerftCase> REFERENCE_SUITE = {
+    {"start",    STARTING_POSITION_FEN, 5, 4865609},
+    {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603},
+    {"pos3",     "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083},
+    {"pos4",     "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5, 15833292},
+    {"pos4b",    "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 5, 15833292},
+    {"pos5",     "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},
+    {"pos6",     "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+};
+
+/**
+ * Perft with the root moves split across threads (each thread takes the next unclaimed root move)
+ */
+uint64_t parallel_perft(ChessGameState* root, int depth, int n_threads) {
+    if (n_threads <= 1 || depth <= 1) return root->perft(depth);
+
+    std::vector<ChessMove> moves = root->get_legal_moves();
+    std::atomic<size_t> next_move(0);
+    std::atomic<uint64_t> nodes(0);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < n_threads; i++) {
+        workers.emplace_back([&]() {
+            uint64_t local_nodes = 0;
+            for (size_t idx = next_move++; idx < moves.size(); idx = next_move++) {
+                local_nodes += ChessGameState(*root, moves[idx]).perft(depth - 1);
+            }
+            nodes += local_nodes;
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    return nodes;
+}
+
+/**
+ * Run and report one position
+ * @return true if the count matches (or nothing was expected)
+ */
+bool run_case(const PerftCase& test, int n_threads) {
+    ChessGameState* root = GameStateFactory::create_state(test.fen);
+
+    auto t1 = std::chrono::steady_clock::now();
+    uint64_t nodes = parallel_perft(root, test.depth, n_threads);
+    auto t2 = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(t2 - t1).count();
+
+    bool is_ok = test.nodes == 0 || nodes == test.nodes;
+
+    std::cout << (test.nodes == 0 ? "     " : (is_ok ? "OK   " : "FAIL "))
+              << test.name << " depth " << test.depth
+              << ": " << nodes << " nodes";
+    if (!is_ok) std::cout << " (expected " << test.nodes << ")";
+    std::cout << ", " << seconds * 1000.0 << " ms, "
+              << (seconds > 0 ? nodes / seconds / 1e6 : 0.0) << " Mnodes/s\n";
+
+    return is_ok;
+}
+
+int main(int argc, char** argv) {
+    std::string fen = "";
+    int depth = 5;
+    uint64_t expected = 0;
+    int n_threads = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << "\n";
+            return 2;
+        }
+
+        if (arg == "--fen") fen = argv[++i];
+        else if (arg == "--depth") depth = std::atoi(argv[++i]);
+        else if (arg == "--expect") expected = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--threads") n_threads = std::atoi(argv[++i]);
+        else {
+            std::cerr << "Unknown argument " << arg << "\n";
+            return 2;
+        }
+    }
+
+    std::vector<PerftCase> cases;
+    if (fen.empty()) cases = REFERENCE_SUITE;
+    else cases.push_back({"fen", fen, depth, expected});
+
+    bool is_ok = true;
+    try {
+        for (const PerftCase& test : cases) {
+            is_ok = run_case(test, n_threads) && is_ok;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+
+    return is_ok ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+#include "Utils/AsyncPublisher.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * AsyncPublisher against a stub endpoint: the sender records what it is given and can be
+ * held, to stand for a slow server, or made to fail.
+ *
+ * Exits with 1 when a message other than the newest survives a backlog, or a counter is off.
+ */
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+class StubEndpoint {
+public:
+    /**
+     * Sender of the stub: "fail..." messages are refused, "throw..." ones throw
+     */
+    Utils::AsyncPublisher::Sender sender() {
+        return [this](const std::string& message) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            n_entered_++;
+            cv_.notify_all();
+            cv_.wait(lock, [this] { return !is_held_; });
+            received_.push_back(message);
+            if (message.rfind("throw", 0) == 0) throw std::runtime_error("endpoint down");
+            return message.rfind("fail", 0) != 0;
+        };
+    }
+
+    void hold() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_held_ = true;
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_held_ = false;
+        }
+        cv_.notify_all();
+    }
+
+    /**
+     * Wait until the sender has been called n times (it may still be held)
+     */
+    void wait_entered(size_t n) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return n_entered_ >= n; });
+    }
+
+    std::vector<std::string> received() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return received_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool is_held_ = false;
+    size_t n_entered_ = 0;
+    std::vector<std::string> received_;
+};
+
+/**
+ * @return false if n messages weren't handed to the sender within a few seconds
+ */
+static bool wait_published(const Utils::AsyncPublisher& publisher, uint64_t n) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (publisher.stats().published < n) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static void test_coalescing() {
+    StubEndpoint endpoint;
+    Utils::AsyncPublisher publisher(endpoint.sender());
+
+    // The first FEN is being sent while the next ones pile up behind the slow endpoint
+    endpoint.hold();
+    publisher.publish("fen1");
+    endpoint.wait_entered(1);
+    publisher.publish("fen2");
+    publisher.publish("fen3");
+    publisher.publish("fen4");
+    endpoint.release();
+
+    check(wait_published(publisher, 2), "coalescing: backlog delivered");
+    check(endpoint.received() == std::vector<std::string>({"fen1", "fen4"}),
+          "coalescing: only the newest FEN survives a slow endpoint");
+
+    Utils::AsyncPublisher::Stats stats = publisher.stats();
+    check(stats.published == 2, "coalescing: published count");
+    check(stats.dropped == 2, "coalescing: dropped count");
+    check(stats.failed == 0, "coalescing: failed count");
+}
+
+static void test_failures() {
+    StubEndpoint endpoint;
+    Utils::AsyncPublisher publisher(endpoint.sender(), 16, false);
+
+    endpoint.hold();
+    for (const char* message : {"ok1", "fail1", "throw1", "ok2", "fail2"}) publisher.publish(message);
+    endpoint.release();
+
+    check(wait_published(publisher, 5), "failures: every message handed to the sender");
+    check(endpoint.received().size() == 5, "failures: no message lost without coalescing");
+
+    Utils::AsyncPublisher::Stats stats = publisher.stats();
+    check(stats.published == 5, "failures: published count");
+    check(stats.failed == 3, "failures: refused and throwing sends counted as failed");
+    check(stats.dropped == 0, "failures: dropped count");
+}
+
+static void test_capacity() {
+    StubEndpoint endpoint;
+    Utils::AsyncPublisher publisher(endpoint.sender(), 2, false);
+
+    endpoint.hold();
+    publisher.publish("m1");
+    endpoint.wait_entered(1);
+    for (const char* message : {"m2", "m3", "m4", "m5"}) publisher.publish(message);
+    endpoint.release();
+
+    check(wait_published(publisher, 3), "capacity: queue delivered");
+    check(endpoint.received() == std::vector<std::string>({"m1", "m4", "m5"}),
+          "capacity: the oldest messages are dropped when full");
+
+    Utils::AsyncPublisher::Stats stats = publisher.stats();
+    check(stats.published == 3, "capacity: published count");
+    check(stats.dropped == 2, "capacity: dropped count");
+}
+
+static void test_latency() {
+    constexpr double DELAY = 0.02;
+    Utils::AsyncPublisher publisher([&](const std::string&) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(DELAY));
+        return true;
+    }, 16, false);
+
+    publisher.publish("a");
+    publisher.publish("b");
+    check(wait_published(publisher, 2), "latency: delivered");
+
+    Utils::AsyncPublisher::Stats stats = publisher.stats();
+    check(stats.max_latency >= DELAY, "latency: max covers the send time");
+    check(stats.total_latency >= 3 * DELAY, "latency: total covers queueing behind a slow send");
+    check(stats.max_latency <= stats.total_latency, "latency: max within total");
+}
+
+static void test_shutdown() {
+    StubEndpoint endpoint;
+    {
+        Utils::AsyncPublisher publisher(endpoint.sender());
+        endpoint.hold();
+        publisher.publish("fen1");
+        endpoint.wait_entered(1);
+        publisher.publish("fen2");
+        publisher.publish("fen3");
+        endpoint.release();
+    }
+    check(endpoint.received() == std::vector<std::string>({"fen1", "fen3"}),
+          "shutdown: the latest queued FEN is delivered before joining");
+}
+
+int main() {
+    test_coalescing();
+    test_failures();
+    test_capacity();
+    test_latency();
+    test_shutdown();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "AsyncPublisher: all checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,273 @@
+#include "FrameRing.h"
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <set>
+#include <thread>
+
+/**
+ * FrameRing driven by a fake camera: buffers are plain memory, "queued to the camera"
+ * means sitting in a deque, and a frame is a counter stamped at the start of the buffer.
+ *
+ * Exits with 1 when a buffer is lost, handed out twice, or a held frame changes.
+ */
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+class FakeCamera {
+public:
+    static constexpr int WIDTH = 4;
+    static constexpr int HEIGHT = 2;
+    static constexpr size_t STRIDE = WIDTH * 3;
+
+    explicit FakeCamera(size_t n_buffers) : memory_(n_buffers, std::vector<uchar>(STRIDE * HEIGHT)) {
+        std::vector<FrameRing::Buffer> buffers;
+        for (auto& memory : memory_) {
+            buffers.push_back({ memory.data(), memory.size(), 0, WIDTH, HEIGHT, STRIDE });
+        }
+        ring = FrameRing::create(std::move(buffers), [this](size_t index) { requeue(index); });
+        for (size_t i = 0; i < n_buffers; i++) queued_.push_back(i);
+    }
+
+    /**
+     * Fill the oldest queued buffer with the next frame
+     * @return Buffer index, -1 if every buffer is away from the camera
+     */
+    int fill(bool is_failed = false) {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queued_.empty()) return -1;
+            index = queued_.front();
+            queued_.pop_front();
+            if (!is_failed) {
+                uint32_t frame = ++frame_count_;
+                std::memcpy(memory_[index].data(), &frame, sizeof(frame));
+            }
+        }
+        if (is_failed) ring->drop(index);
+        else ring->complete(index);
+        return (int)index;
+    }
+
+    /**
+     * The oldest queued buffer comes back without a frame, and the capture is given up on
+     * @return Buffer index, -1 if every buffer is away from the camera
+     */
+    int fail() {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queued_.empty()) return -1;
+            index = queued_.front();
+            queued_.pop_front();
+        }
+        ring->fail(index);
+        return (int)index;
+    }
+
+    size_t n_queued() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queued_.size();
+    }
+
+    uint32_t last_frame() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return frame_count_;
+    }
+
+    std::shared_ptr<FrameRing> ring;
+    bool is_double_queued = false;
+
+private:
+    void requeue(size_t index) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t queued : queued_) {
+            if (queued == index) is_double_queued = true;
+        }
+        queued_.push_back(index);
+    }
+
+    std::vector<std::vector<uchar>> memory_;
+    std::mutex mutex_;
+    std::deque<size_t> queued_;
+    uint32_t frame_count_ = 0;
+};
+
+static uint32_t frame_of(const cv::Mat& view) {
+    uint32_t frame;
+    std::memcpy(&frame, view.data, sizeof(frame));
+    return frame;
+}
+
+static void test_complete_acquire_release() {
+    FakeCamera camera(3);
+
+    camera.fill();
+    cv::Mat view = camera.ring->acquire();
+    check(!view.empty() && view.rows == FakeCamera::HEIGHT && view.cols == FakeCamera::WIDTH,
+          "acquire returns a view of the buffer");
+    check(frame_of(view) == 1, "acquire returns the completed frame");
+    check(camera.n_queued() == 2, "an acquired buffer is not requeued");
+
+    cv::Mat copy = view;
+    view.release();
+    check(camera.n_queued() == 2, "a buffer is held while a copy of its view is alive");
+    copy.release();
+    check(camera.n_queued() == 3, "a buffer is requeued with the last copy of its view");
+    check(camera.ring->dropped() == 0, "nothing dropped");
+}
+
+static void test_supersede() {
+    FakeCamera camera(3);
+
+    camera.fill();
+    camera.fill();
+    check(camera.ring->dropped() == 1, "a frame never acquired is dropped when superseded");
+    check(camera.n_queued() == 2, "the superseded buffer is requeued");
+
+    cv::Mat view = camera.ring->acquire();
+    check(frame_of(view) == 2, "acquire returns the newest frame");
+
+    // Supersede the held frame many times: its buffer must stay away from the camera
+    for (int i = 0; i < 10; i++) camera.fill();
+    check(frame_of(view) == 2, "a held frame stays valid after being superseded");
+    check(camera.n_queued() == 1, "only the held and the ready buffers are away from the camera");
+
+    cv::Mat newest = camera.ring->acquire();
+    check(frame_of(newest) == camera.last_frame(), "acquire skips to the newest frame");
+    check(newest.data != view.data, "a held buffer is not handed out twice");
+
+    view.release();
+    newest.release();
+    check(camera.n_queued() == 3, "no buffer lost after superseding");
+    check(!camera.is_double_queued, "no buffer requeued twice");
+}
+
+static void test_drop() {
+    FakeCamera camera(3);
+
+    camera.fill(true);
+    check(camera.ring->dropped() == 1, "a failed request counts as dropped");
+    check(camera.n_queued() == 3, "a failed request is requeued straight away");
+
+    camera.fill();
+    camera.fill(true);
+    cv::Mat view = camera.ring->acquire();
+    check(frame_of(view) == 1, "a failed request doesn't supersede the ready frame");
+    view.release();
+    check(camera.n_queued() == 3, "no buffer lost after failed requests");
+    check(!camera.is_double_queued, "no buffer requeued twice");
+}
+
+static void test_fail() {
+    FakeCamera camera(2);
+
+    // Nothing ready: the waiting consumer is told the frame won't come
+    std::thread consumer([&]() {
+        check(camera.ring->acquire().empty(), "acquire returns an empty view after fail");
+    });
+    camera.fail();
+    consumer.join();
+    check(camera.ring->dropped() == 1, "a failed frame counts as dropped");
+    check(camera.n_queued() == 2, "a failed buffer is requeued");
+
+    camera.fill();
+    cv::Mat view = camera.ring->acquire();
+    check(frame_of(view) == 1, "a failure is reported once");
+    view.release();
+    check(!camera.is_double_queued, "no buffer requeued twice after fail");
+}
+
+static void test_stop() {
+    FakeCamera camera(3);
+
+    camera.fill();
+    cv::Mat view = camera.ring->acquire();
+    camera.ring->stop();
+    check(camera.ring->acquire().empty(), "acquire returns an empty view once stopped");
+
+    std::weak_ptr<FrameRing> weak = camera.ring;
+    camera.ring.reset();
+    check(!weak.expired(), "a view keeps the ring alive");
+    check(frame_of(view) == 1, "a view stays valid after the ring is stopped");
+
+    view.release();
+    check(weak.expired(), "the ring is released with the last view");
+    check(camera.n_queued() == 2, "nothing is requeued once stopped");
+}
+
+/**
+ * Camera and consumer threads, the consumer holding a random number of frames for a random time.
+ * The camera never gets back a buffer still held, and every buffer comes back in the end.
+ */
+static void test_threads() {
+    constexpr size_t N_BUFFERS = 6;
+    FakeCamera camera(N_BUFFERS);
+    std::atomic<bool> is_running(true);
+    std::atomic<bool> is_reused(false);
+
+    std::thread source([&]() {
+        std::mt19937 rng(1);
+        while (is_running) {
+            camera.fill(rng() % 16 == 0);
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    });
+
+    std::mt19937 rng(2);
+    std::deque<std::pair<cv::Mat, uint32_t>> held;
+    uint32_t last = 0;
+    for (int i = 0; i < 2000; i++) {
+        cv::Mat view = camera.ring->acquire();
+        uint32_t frame = frame_of(view);
+        check(frame > last, "acquire only returns newer frames");
+        last = frame;
+
+        std::set<const uchar*> held_data;
+        for (auto& entry : held) {
+            if (frame_of(entry.first) != entry.second) is_reused = true;
+            held_data.insert(entry.first.data);
+        }
+        check(held_data.count(view.data) == 0, "a held buffer is not handed out twice");
+
+        held.emplace_back(view, frame);
+        while (held.size() > rng() % (N_BUFFERS - 1)) held.pop_front();
+    }
+    check(!is_reused, "held frames are never overwritten by the camera");
+
+    is_running = false;
+    source.join();
+    held.clear();
+
+    // One more frame supersedes the one the ring may still hold, then only that one is away
+    camera.fill();
+    check(camera.n_queued() == N_BUFFERS - 1, "no buffer lost under concurrency");
+    check(!camera.is_double_queued, "no buffer requeued twice under concurrency");
+}
+
+int main() {
+    test_complete_acquire_release();
+    test_supersede();
+    test_drop();
+    test_fail();
+    test_stop();
+    test_threads();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "FrameRing: all checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "ImageProvider.h"
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+/**
+ * ImageProvider in latest frame mode over a SYNTHETIC source the test releases frame by
+ * frame, so the newest frame and the number of dropped ones are known exactly.
+ *
+ * Exits with 1 when take_image returns anything but the newest frame, or a count is off.
+ */
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+/**
+ * Frame n is a 1x1 CV_32S image holding n, served only once allowed
+ */
+class GatedSource {
+public:
+    ImageProvider::FrameSource source() {
+        return [this]() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            n_calls_++;
+            cv_.notify_all();
+            cv_.wait(lock, [this] { return n_served_ < n_allowed_ || is_ended_ || is_failed_; });
+            if (n_served_ < n_allowed_) {
+                n_served_++;
+                return cv::Mat(1, 1, CV_32S, cv::Scalar(n_served_));
+            }
+            if (is_failed_) throw std::runtime_error("source failed");
+            return cv::Mat();
+        };
+    }
+
+    void allow(int n) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            n_allowed_ += n;
+        }
+        cv_.notify_all();
+    }
+
+    /**
+     * Wait until every allowed frame was handed to the provider and the source is called again
+     */
+    void wait_served() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return n_calls_ > n_allowed_; });
+    }
+
+    void end(bool is_failed = false) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_ended_ = true;
+            is_failed_ = is_failed;
+        }
+        cv_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int n_calls_ = 0;
+    int n_allowed_ = 0;
+    int n_served_ = 0;
+    bool is_ended_ = false;
+    bool is_failed_ = false;
+};
+
+static int frame_of(const cv::Mat& img) {
+    return img.empty() ? 0 : img.at<int>(0, 0);
+}
+
+static void test_latest_frame() {
+    GatedSource source;
+    ImageProvider camera(source.source(), 0.0, true);
+
+    source.allow(1);
+    source.wait_served();
+    check(frame_of(camera.take_image()) == 1, "latest: take_image returns the only frame");
+    check(camera.dropped_frames == 0, "latest: nothing dropped while keeping up");
+
+    source.allow(3);
+    source.wait_served();
+    std::chrono::steady_clock::time_point capture_time;
+    check(frame_of(camera.take_image(capture_time)) == 4, "latest: take_image returns the newest frame");
+    check(capture_time != std::chrono::steady_clock::time_point(), "latest: capture time of the frame");
+    check(camera.dropped_frames == 2, "latest: frames replaced before being taken are dropped");
+
+    source.allow(2);
+    source.wait_served();
+    source.end();
+    check(frame_of(camera.take_image()) == 6, "latest: the newest frame is still taken after the source ends");
+    check(camera.dropped_frames == 3, "latest: dropped count");
+    check(camera.take_image().empty(), "latest: empty once the source ended");
+}
+
+static void test_every_frame() {
+    GatedSource source;
+    ImageProvider camera(source.source(), 0.005, false);
+
+    source.allow(3);
+    source.end();
+    for (int i = 1; i <= 3; i++) check(frame_of(camera.take_image()) == i, "sync: every frame in order");
+    check(camera.take_image().empty(), "sync: empty once the source ended");
+    check(camera.dropped_frames == 0, "sync: nothing dropped");
+    check(camera.total_wait_time > 0.0, "sync: pacing counted in total_wait_time");
+}
+
+static void test_source_error() {
+    GatedSource source;
+    ImageProvider camera(source.source(), 0.0, true);
+
+    source.end(true);
+    bool is_thrown = false;
+    try {
+        camera.take_image();
+    } catch (const std::runtime_error&) {
+        is_thrown = true;
+    }
+    check(is_thrown, "error: a source failure is rethrown by take_image");
+}
+
+int main() {
+    test_latest_frame();
+    test_every_frame();
+    test_source_error();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "ImageProvider: all checks passed" << std::endl;
+    return 0;
+}